@@ -1,5 +1,8 @@
 #include "../lifelib/bitworld.h"
 
+// Number of consecutive soups whose hashes are computed together:
+#define SOUP_BATCH 16
+
 namespace apg {
 
     // Reverse each byte in an integer:
@@ -50,16 +53,11 @@ namespace apg {
         transpose8rS32(A+17, 2, 2, B+17);
     }
 
-// Produce a SHA-256 hash of a string, and use it to generate a soup:
-bitworld hashsoup_inner(std::string prehash, std::string symmetry) {
+// Use the SHA-256 hash of a string to generate a soup:
+bitworld hashsoup_inner(const uint8_t* hashed, std::string symmetry) {
 
     uint8_t digest[32];
-    memset(digest, 0, 32);
-
-    SHA256 ctx = SHA256();
-    ctx.init();
-    ctx.update( (unsigned char*)prehash.c_str(), prehash.length());
-    ctx.final(digest);
+    std::memcpy(digest, hashed, 32);
 
     uint8_t tsegid[32];
     memset(tsegid, 0, 32);
@@ -169,7 +167,7 @@ bitworld hashsoup_inner(std::string prehash, std::string symmetry) {
 
 }
 
-bitworld hashsoup(std::string prehash, std::string full_symmetry) {
+bitworld hashsoup(const uint8_t* digest, std::string full_symmetry) {
 
     std::string symmetry = full_symmetry;
     uint64_t inflations = 0;
@@ -178,7 +176,7 @@ bitworld hashsoup(std::string prehash, std::string full_symmetry) {
         symmetry = symmetry.substr(1);
     }
     // std::cout << inflations << " " << symmetry << std::endl;
-    bitworld bw = hashsoup_inner(prehash, symmetry);
+    bitworld bw = hashsoup_inner(digest, symmetry);
     for (uint64_t i = 0; i < inflations; i++) {
         bw = bw.inflate();
     }
@@ -186,6 +184,269 @@ bitworld hashsoup(std::string prehash, std::string full_symmetry) {
     return bw;
 }
 
+/*
+ * Every supported symmetry (bar inflation), so that the soup generator can
+ * be specialised at compile time rather than comparing symmetry strings
+ * for every soup:
+ */
+enum soupsym {
+    SYM_C1, SYM_C2_4, SYM_C2_2, SYM_C2_1, SYM_C4_4, SYM_C4_1,
+    SYM_8x32, SYM_4x64, SYM_2x128, SYM_1x256,
+    SYM_D2_p2, SYM_D2_p1, SYM_D2_x, SYM_D4_p4, SYM_D4_p2, SYM_D4_p1,
+    SYM_D4_x4, SYM_D4_x1, SYM_D8_4, SYM_D8_1
+};
+
+/*
+ * A soup in fixed storage: n nonzero 8-by-8 blocks, with the same
+ * coordinates and bit layout as the entries of a bitworld.
+ */
+struct soupblocks {
+    int n;
+    int32_t x[32];
+    int32_t y[32];
+    uint64_t v[32];
+
+    void push(int32_t bx, int32_t by, uint64_t bv) {
+        if (bv != 0) { x[n] = bx; y[n] = by; v[n] = bv; n += 1; }
+    }
+
+    bitworld to_bitworld() {
+        bitworld bw;
+        for (int i = 0; i < n; i++) {
+            bw.world[std::pair<int32_t, int32_t>(x[i], y[i])] = v[i];
+        }
+        return bw;
+    }
+};
+
+// Reverse the lowest 16 bits of an integer:
+uint32_t uint16_reverse(uint32_t x) {
+    uint32_t y = ((x & 0xaaaau) >> 1) | ((x & 0x5555u) << 1);
+             y = ((y & 0xccccu) >> 2) | ((y & 0x3333u) << 2);
+             y = ((y & 0xf0f0u) >> 4) | ((y & 0x0f0fu) << 4);
+             y = ((y & 0xff00u) >> 8) | ((y & 0x00ffu) << 8);
+    return y;
+}
+
+// OR a 16-by-16 quadrant into a 32-by-32 soup whose rows span y = -16 to 15:
+void place_quadrant(uint32_t* rows, const uint32_t* quadrant, int dx, int dy) {
+    for (int y = 0; y < 16; y++) {
+        rows[16 + dy + y] |= (quadrant[y] << dx);
+    }
+}
+
+/*
+ * Equivalent to hashsoup_inner(hashed, symmetry).world, but with the
+ * symmetry fixed at compile time. The soup is assembled as 32 rows of
+ * 32 bits, where reflections and odd offsets are cheap, and then cut
+ * into blocks; no std::map or std::string is involved.
+ */
+template<int S>
+void hashsoup_blocks(const uint8_t* hashed, soupblocks &sb) {
+
+    uint8_t digest[32];
+    std::memcpy(digest, hashed, 32);
+    sb.n = 0;
+
+    if ((S == SYM_8x32) || (S == SYM_4x64) || (S == SYM_2x128) || (S == SYM_1x256)) {
+        const int height = (S == SYM_8x32) ? 8 : ((S == SYM_4x64) ? 4 : ((S == SYM_2x128) ? 2 : 1));
+        const int eighthwidth = 32 / height;
+        for (int i = 0; i < eighthwidth; i++) {
+            uint64_t v = 0;
+            for (int j = 0; j < height; j++) {
+                v |= (((uint64_t) digest[eighthwidth*j+i]) << (8*j));
+            }
+            sb.push(eighthwidth - 1 - i, 0, v);
+        }
+        return;
+    }
+
+    const bool diagonal = (S == SYM_D2_x) || (S == SYM_D8_4) || (S == SYM_D8_1) || (S == SYM_D4_x4) || (S == SYM_D4_x1);
+    const bool rotational = (S == SYM_C4_4) || (S == SYM_C4_1) || (S == SYM_D4_x4) || (S == SYM_D4_x1);
+
+    uint8_t tsegid[32];
+    if (diagonal || rotational) {
+        memset(tsegid, 0, 32);
+        transpose16(digest, tsegid);
+    }
+
+    if (diagonal) {
+        // We make our arrays diagonally symmetric:
+        uint8_t diggid[32];
+        memset(diggid, 0, 32);
+        for (int i = 0; i < 8; i++) {
+            diggid[2*i] = (digest[2*i] & ((1 << (8 - i)) - 1)) | (tsegid[2*i] & (256 - (1 << (8 - i))));
+            diggid[2*i + 17] = (digest[2*i + 17] & ((1 << (8 - i)) - 1)) | (tsegid[2*i + 17] & (256 - (1 << (8 - i))));
+            diggid[2*i + 1] = digest[2*i + 1];
+            diggid[2*i + 16] = tsegid[2*i + 16];
+        }
+
+        for (int i = 0; i < 32; i++) {
+            tsegid[i] ^= (diggid[i] ^ digest[i]);
+        }
+        std::memcpy(digest, diggid, 32);
+    }
+
+    // The digest forms the quadrant 0 <= x, y < 16:
+    uint32_t rows[32] = {0};
+    uint32_t q[16];
+    for (int k = 0; k < 16; k++) {
+        q[k] = digest[2*k+1] | (((uint32_t) digest[2*k]) << 8);
+    }
+    place_quadrant(rows, q, 0, 0);
+
+    if ((S != SYM_C1) && (S != SYM_D2_x)) {
+
+        // Images of the quadrant under reflection and rotation:
+        uint32_t dq[16]; uint32_t vq[16]; uint32_t hq[16];
+        for (int k = 0; k < 16; k++) {
+            uint32_t t = rotational ? (tsegid[2*k+1] | (((uint32_t) tsegid[2*k]) << 8)) : q[k];
+            dq[15-k] = uint16_reverse(q[k]);
+            vq[15-k] = t;
+            hq[k] = uint16_reverse(t);
+        }
+
+        if (S == SYM_D2_p1) {
+            place_quadrant(rows, vq, 0, -15);
+        } else if (S == SYM_D2_p2) {
+            place_quadrant(rows, vq, 0, -16);
+        } else if (S == SYM_C2_4) {
+            place_quadrant(rows, dq, 16, -16);
+        } else if (S == SYM_C2_2) {
+            place_quadrant(rows, dq, 16, -15);
+        } else if (S == SYM_C2_1) {
+            place_quadrant(rows, dq, 15, -15);
+        } else if ((S == SYM_D8_4) || (S == SYM_D4_p4) || (S == SYM_D4_x4) || (S == SYM_C4_4)) {
+            place_quadrant(rows, vq, 0, -16);
+            place_quadrant(rows, hq, 16, 0);
+            place_quadrant(rows, dq, 16, -16);
+        } else if (S == SYM_D4_p2) {
+            place_quadrant(rows, vq, 0, -15);
+            place_quadrant(rows, hq, 16, 0);
+            place_quadrant(rows, dq, 16, -15);
+        } else {
+            place_quadrant(rows, vq, 0, -15);
+            place_quadrant(rows, hq, 15, 0);
+            place_quadrant(rows, dq, 15, -15);
+        }
+    }
+
+    // Cut the rows into 8-by-8 blocks:
+    for (int by = -2; by < 2; by++) {
+        for (int bx = 0; bx < 4; bx++) {
+            uint64_t v = 0;
+            for (int j = 0; j < 8; j++) {
+                v |= (((uint64_t) ((rows[16 + 8*by + j] >> (8*bx)) & 255)) << (8*j));
+            }
+            sb.push(bx, by, v);
+        }
+    }
+}
+
+// Generate a soup of compile-time symmetry S straight into a upattern:
+template<int S, typename U>
+void insertSoup(U &pat, const uint8_t* digest) {
+    soupblocks sb;
+    hashsoup_blocks<S>(digest, sb);
+    pat.insertBlocks(0, sb.n, sb.x, sb.y, sb.v);
+}
+
+// The names of the soupsym enumerators, in the same order:
+const char* const soupsymnames[] = {
+    "C1", "C2_4", "C2_2", "C2_1", "C4_4", "C4_1",
+    "8x32", "4x64", "2x128", "1x256",
+    "D2_+2", "D2_+1", "D2_x", "D4_+4", "D4_+2", "D4_+1",
+    "D4_x4", "D4_x1", "D8_4", "D8_1"
+};
+
+// Index of a symmetry in soupsymnames, or -1 if it is not supported:
+int soupsymindex(std::string symmetry) {
+    for (int i = 0; i <= SYM_D8_1; i++) {
+        if (symmetry == soupsymnames[i]) { return i; }
+    }
+    return -1;
+}
+
+bool validsymmetry(std::string full_symmetry) {
+    size_t inflations = full_symmetry.find_first_not_of('i');
+    if (inflations == std::string::npos) { return false; }
+    return (soupsymindex(full_symmetry.substr(inflations)) >= 0);
+}
+
+template<typename U>
+using soupinserter = void (*)(U&, const uint8_t*);
+
+/*
+ * Look up the specialised generator for a symmetry chosen at runtime.
+ * Inflated symmetries have none, and go through hashsoup instead:
+ */
+template<typename U>
+soupinserter<U> getinserter(std::string symmetry) {
+    switch (soupsymindex(symmetry)) {
+        case SYM_C1 : return &insertSoup<SYM_C1, U>;
+        case SYM_C2_4 : return &insertSoup<SYM_C2_4, U>;
+        case SYM_C2_2 : return &insertSoup<SYM_C2_2, U>;
+        case SYM_C2_1 : return &insertSoup<SYM_C2_1, U>;
+        case SYM_C4_4 : return &insertSoup<SYM_C4_4, U>;
+        case SYM_C4_1 : return &insertSoup<SYM_C4_1, U>;
+        case SYM_8x32 : return &insertSoup<SYM_8x32, U>;
+        case SYM_4x64 : return &insertSoup<SYM_4x64, U>;
+        case SYM_2x128 : return &insertSoup<SYM_2x128, U>;
+        case SYM_1x256 : return &insertSoup<SYM_1x256, U>;
+        case SYM_D2_p2 : return &insertSoup<SYM_D2_p2, U>;
+        case SYM_D2_p1 : return &insertSoup<SYM_D2_p1, U>;
+        case SYM_D2_x : return &insertSoup<SYM_D2_x, U>;
+        case SYM_D4_p4 : return &insertSoup<SYM_D4_p4, U>;
+        case SYM_D4_p2 : return &insertSoup<SYM_D4_p2, U>;
+        case SYM_D4_p1 : return &insertSoup<SYM_D4_p1, U>;
+        case SYM_D4_x4 : return &insertSoup<SYM_D4_x4, U>;
+        case SYM_D4_x1 : return &insertSoup<SYM_D4_x1, U>;
+        case SYM_D8_4 : return &insertSoup<SYM_D8_4, U>;
+        case SYM_D8_1 : return &insertSoup<SYM_D8_1, U>;
+    }
+    return 0;
+}
+
+// Produce a SHA-256 hash of a string, and use it to generate a soup:
+bitworld hashsoup(std::string prehash, std::string full_symmetry) {
+
+    uint8_t digest[32];
+    memset(digest, 0, 32);
+
+    SHA256 ctx = SHA256();
+    ctx.init();
+    ctx.update( (unsigned char*)prehash.c_str(), prehash.length());
+    ctx.final(digest);
+
+    return hashsoup(digest, full_symmetry);
+}
+
+/*
+ * Hash the n consecutive soups seedroot + first, ..., seedroot + (first + n - 1)
+ * in one go, writing their 32-byte digests into the preallocated buffer:
+ */
+void hashsoups(std::string seedroot, int64_t first, int n, uint8_t* digests) {
+
+    // Room for the seed and a 64-bit soup number, in scratch space which
+    // each thread keeps between batches:
+    unsigned int stride = seedroot.length() + 24;
+    static thread_local std::vector<unsigned char> prehashes;
+    static thread_local std::vector<const unsigned char*> messages;
+    static thread_local std::vector<unsigned int> lengths;
+    if (prehashes.size() < stride * n) { prehashes.resize(stride * n); }
+    if (messages.size() < (size_t) n) { messages.resize(n); lengths.resize(n); }
+
+    for (int i = 0; i < n; i++) {
+        unsigned char* prehash = &(prehashes[stride * i]);
+        std::memcpy(prehash, seedroot.c_str(), seedroot.length());
+        int digits = snprintf((char*) prehash + seedroot.length(), 24, "%lld", (long long) (first + i));
+        messages[i] = prehash;
+        lengths[i] = seedroot.length() + digits;
+    }
+
+    SHA256::batch(&(messages[0]), &(lengths[0]), n, digests);
+}
+
 }
 
 
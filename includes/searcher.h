@@ -1,72 +1,177 @@
 #pragma once
 
+/*
+ * The rule and symmetry to search, chosen at runtime from those which
+ * have been compiled in (see params.h):
+ */
+struct SearchParams {
+
+    std::string rulestring;
+    std::string symmetry;
+    int rule; // index of the rule's kernels, as given by apg::rule2int
+    std::string cachefile; // objects classified by earlier runs, if nonempty
+
+    SearchParams(std::string rulestring, std::string symmetry, std::string cachefile) {
+        this->rulestring = rulestring;
+        this->symmetry = symmetry;
+        this->rule = apg::rule2int(rulestring);
+        this->cachefile = cachefile;
+    }
+
+    // B3/S23 soups are incubated, and rare objects are reported:
+    bool standardLife() const { return (rulestring == "b3s23"); }
+
+};
+
+// Extract the cells of a stabilised soup for censusing:
+template<typename U>
+void extractCells(U &pat, std::vector<apg::bitworld> &bwv, bool incubate, uint64_t* excess) {
+    pat.extractPattern(bwv);
+}
+
+void extractCells(apg::upattern<apg::VTile28, 28> &pat, std::vector<apg::bitworld> &bwv, bool incubate, uint64_t* excess) {
+    if (incubate) {
+        apg::incubator<56, 56> icb;
+        apg::copycells(&pat, &icb);
+        icb.purge(excess);
+        icb.to_bitworld(bwv[0], 0);
+        icb.to_bitworld(bwv[1], 1);
+    } else {
+        pat.extractPattern(bwv);
+    }
+}
+
+/*
+ * Object counts for a thread's share of a haul, indexed by the IDs which
+ * apg::apgcodes assigns to apgcodes, with up to ten sample soups for each
+ * object. Threads count into their own census and merge them per haul.
+ */
+struct SoupCensus {
+
+    std::vector<long long> counts;
+    std::vector<std::vector<std::string> > occurrences;
+
+    void add(uint32_t id, long long quantity, const std::string &suffix) {
+        if (id >= counts.size()) {
+            counts.resize(id + 1);
+            occurrences.resize(id + 1);
+        }
+        counts[id] += quantity;
+        std::vector<std::string> &occ = occurrences[id];
+        if ((occ.size() < 10) && ((occ.size() == 0) || (occ.back() != suffix))) {
+            occ.push_back(suffix);
+        }
+    }
+
+    void merge(const SoupCensus &other) {
+        if (other.counts.size() > counts.size()) {
+            counts.resize(other.counts.size());
+            occurrences.resize(other.counts.size());
+        }
+        for (unsigned int id = 0; id < other.counts.size(); id++) {
+            counts[id] += other.counts[id];
+            const std::vector<std::string> &occ = other.occurrences[id];
+            for (unsigned int i = 0; (i < occ.size()) && (occurrences[id].size() < 10); i++) {
+                occurrences[id].push_back(occ[i]);
+            }
+        }
+    }
+
+    void clear() {
+        counts.clear();
+        occurrences.clear();
+    }
+
+};
+
 /*
  * This contains everything necessary for performing a soup search.
  */
+template<int BITPLANES, typename UPATTERN>
 class SoupSearcher {
 
 public:
 
-    std::map<std::string, long long> census;
-    std::map<std::string, std::vector<std::string> > alloccur;
+    SearchParams params;
+    apg::soupinserter<UPATTERN> inserter;
 
-    void aggregate(std::map<std::string, long long> *newcensus, std::map<std::string, std::vector<std::string> > *newoccur) {
+    SoupCensus census;
 
-        std::map<std::string, long long>::iterator it;
-        for (it = newcensus->begin(); it != newcensus->end(); it++)
-        {
-            std::string apgcode = it->first;
-            long long quantity = it->second;
-            census[apgcode] += quantity;
+    // Reused for every soup, so that tile memory is recycled:
+    UPATTERN universe;
 
-        }
+    SoupSearcher(const SearchParams &params) : params(params) {
+        inserter = apg::getinserter<UPATTERN>(params.symmetry);
+    }
+
+    void aggregate(const SoupCensus &newcensus) {
+        census.merge(newcensus);
+    }
+
+    // How separate() treats each object, worked out once per apgcode ID:
+    enum ObjectKind { ORDINARY, PATHOLOGICAL, IRREGULAR, LINEAR_GROWTH, CHAOTIC_GROWTH, RARE_OSCILLATOR, RARE_SPACESHIP };
+    std::vector<int8_t> kinds;
+
+    int classifyApgcode(const std::string &apgcode) {
 
-        std::map<std::string, std::vector<std::string> >::iterator it2;
-        for (it2 = newoccur->begin(); it2 != newoccur->end(); it2++)
-        {
-            std::string apgcode = it2->first;
-            std::vector<std::string> occurrences = it2->second;
-            for (unsigned int i = 0; i < occurrences.size(); i++) {
-                if (alloccur[apgcode].size() < 10) {
-                    alloccur[apgcode].push_back(occurrences[i]);
+        bool standardLife = params.standardLife();
+
+        if (apgcode == "PATHOLOGICAL") {
+            return PATHOLOGICAL;
+        } else if (standardLife && (apgcode[0] == 'x') && (apgcode[1] == 'p')) {
+            if ((apgcode[2] != '2') || (apgcode[3] != '_')) {
+                if (apgcode.compare("xp3_co9nas0san9oczgoldlo0oldlogz1047210127401") != 0 && apgcode.compare("xp15_4r4z4r4") != 0) {
+                    // Interesting oscillator:
+                    return RARE_OSCILLATOR;
                 }
             }
+        } else if (standardLife && (apgcode[0] == 'x') && (apgcode[1] == 'q')) {
+            if (apgcode.compare("xq4_153") != 0 && apgcode.compare("xq4_6frc") != 0 && apgcode.compare("xq4_27dee6") != 0 && apgcode.compare("xq4_27deee6") != 0) {
+                return RARE_SPACESHIP;
+            }
+        } else if ((apgcode[0] == 'y') && (apgcode[1] == 'l')) {
+            return LINEAR_GROWTH;
+        } else if (apgcode[0] == 'y') {
+            return IRREGULAR;
+        } else if ((apgcode[0] == 'z') && (apgcode[1] == 'z')) {
+            return CHAOTIC_GROWTH;
         }
+        return ORDINARY;
+    }
+
+    int objectKind(uint32_t id) {
+        if (id >= kinds.size()) { kinds.resize(id + 1, -1); }
+        if (kinds[id] < 0) { kinds[id] = classifyApgcode(apg::apgcodes.apgcode(id)); }
+        return kinds[id];
     }
 
     bool separate(UPATTERN &pat, int duration, bool proceedNonetheless, apg::base_classifier<BITPLANES> &cfier, std::string suffix) {
 
+        bool standardLife = params.standardLife();
+
         pat.decache();
-        pat.advance(0, 1, duration);
+        pat.advance(params.rule, 1, duration);
         std::vector<apg::bitworld> bwv(BITPLANES + 1);
 
-        #ifdef INCUBATE
-        apg::incubator<56, 56> icb;
-        apg::copycells(&pat, &icb);
         uint64_t excess[8] = {0};
-        icb.purge(excess);
-        icb.to_bitworld(bwv[0], 0);
-        icb.to_bitworld(bwv[1], 1);
-        #else
-        pat.extractPattern(bwv);
-        #endif
+        extractCells(pat, bwv, standardLife, excess);
 
-        std::map<std::string, int64_t> cm = cfier.census(bwv, &classifyAperiodic);
+        std::map<uint32_t, int64_t> cm = cfier.census_ids(bwv, &classifyAperiodic);
 
-        #ifdef INCUBATE
-        if (excess[3] > 0) { cm["xp2_7"] += excess[3]; }
-        if (excess[4] > 0) { cm["xs4_33"] += excess[4]; }
-        if (excess[5] > 0) { cm["xq4_153"] += excess[5]; }
-        if (excess[6] > 0) { cm["xs6_696"] += excess[6]; }
-        #endif
+        static const uint32_t excessIds[4] = {apg::apgcodes.intern("xp2_7"), apg::apgcodes.intern("xs4_33"),
+                                              apg::apgcodes.intern("xq4_153"), apg::apgcodes.intern("xs6_696")};
+        for (int i = 0; i < 4; i++) {
+            if (excess[i + 3] > 0) { cm[excessIds[i]] += excess[i + 3]; }
+        }
 
         bool ignorePathologicals = false;
         int pathologicals = 0;
 
         for (auto it = cm.begin(); it != cm.end(); ++it) {
-            if (it->first[0] == 'y') {
+            int kind = objectKind(it->first);
+            if ((kind == IRREGULAR) || (kind == LINEAR_GROWTH)) {
                 ignorePathologicals = true;
-            } else if (it->first == "PATHOLOGICAL") {
+            } else if (kind == PATHOLOGICAL) {
                 pathologicals += 1;
             }
         }
@@ -80,56 +185,41 @@ public:
         }
 
         for (auto it = cm.begin(); it != cm.end(); ++it) {
-            std::string apgcode = it->first;
-            if ((ignorePathologicals == false) || (apgcode.compare("PATHOLOGICAL") != 0)) {
-                census[apgcode] += it->second;
-                if (alloccur[apgcode].size() == 0 || alloccur[apgcode].back().compare(suffix) != 0) {
-                    if (alloccur[apgcode].size() < 10) {
-                        alloccur[apgcode].push_back(suffix);
-                    }
-                }
+            int kind = objectKind(it->first);
+            if ((ignorePathologicals == false) || (kind != PATHOLOGICAL)) {
+                census.add(it->first, it->second, suffix);
             }
 
-            #ifdef STANDARD_LIFE
-            if ((apgcode[0] == 'x') && (apgcode[1] == 'p')) {
-                if ((apgcode[2] != '2') || (apgcode[3] != '_')) {
-                    if (apgcode.compare("xp3_co9nas0san9oczgoldlo0oldlogz1047210127401") != 0 && apgcode.compare("xp15_4r4z4r4") != 0) {
-                        // Interesting oscillator:
-                        std::cout << "Rare oscillator detected: \033[1;31m" << apgcode << "\033[0m" << std::endl;
-                    }
-                }
-            } else if ((apgcode[0] == 'x') && (apgcode[1] == 'q')) {
-                if (apgcode.compare("xq4_153") != 0 && apgcode.compare("xq4_6frc") != 0 && apgcode.compare("xq4_27dee6") != 0 && apgcode.compare("xq4_27deee6") != 0) {
-                    std::cout << "Rare spaceship detected: \033[1;34m" << apgcode << "\033[0m" << std::endl;
-                }
-            } else if ((apgcode[0] == 'y') && (apgcode[1] == 'l')) {
-                std::cout << "Linear-growth pattern detected: \033[1;32m" << apgcode << "\033[0m" << std::endl;
-            } else if ((apgcode[0] == 'z') && (apgcode[1] == 'z')) {
-                std::cout << "Chaotic-growth pattern detected: \033[1;32m" << apgcode << "\033[0m" << std::endl;
-            }
-            #else
-            if ((apgcode[0] == 'y') && (apgcode[1] == 'l')) {
-                std::cout << "Linear-growth pattern detected: \033[1;32m" << apgcode << "\033[0m" << std::endl;
-            } else if ((apgcode[0] == 'z') && (apgcode[1] == 'z')) {
-                std::cout << "Chaotic-growth pattern detected: \033[1;32m" << apgcode << "\033[0m" << std::endl;
+            if (kind == RARE_OSCILLATOR) {
+                std::cout << "Rare oscillator detected: \033[1;31m" << apg::apgcodes.apgcode(it->first) << "\033[0m" << std::endl;
+            } else if (kind == RARE_SPACESHIP) {
+                std::cout << "Rare spaceship detected: \033[1;34m" << apg::apgcodes.apgcode(it->first) << "\033[0m" << std::endl;
+            } else if (kind == LINEAR_GROWTH) {
+                std::cout << "Linear-growth pattern detected: \033[1;32m" << apg::apgcodes.apgcode(it->first) << "\033[0m" << std::endl;
+            } else if (kind == CHAOTIC_GROWTH) {
+                std::cout << "Chaotic-growth pattern detected: \033[1;32m" << apg::apgcodes.apgcode(it->first) << "\033[0m" << std::endl;
             }
-            #endif
-
-
         }
         return false;
 
     }
 
-    void censusSoup(std::string seedroot, std::string suffix, apg::base_classifier<BITPLANES> &cfier) {
+    void censusSoup(const uint8_t* digest, std::string suffix, apg::base_classifier<BITPLANES> &cfier) {
 
-        apg::bitworld bw = apg::hashsoup(seedroot + suffix, SYMMETRY);
-        std::vector<apg::bitworld> vbw;
-        vbw.push_back(bw);
-        UPATTERN pat;
-        pat.insertPattern(vbw);
+        UPATTERN &pat = universe;
+        pat.reset();
+
+        if (inserter) {
+            inserter(pat, digest);
+        } else {
+            // Inflated soups are rare enough to go through a bitworld:
+            apg::bitworld bw = apg::hashsoup(digest, params.symmetry);
+            std::vector<apg::bitworld> vbw;
+            vbw.push_back(bw);
+            pat.insertPattern(vbw);
+        }
 
-        int duration = stabilise3(pat);
+        int duration = stabilise3(pat, params.rule);
 
         bool failure = true;
         int attempt = 0;
@@ -150,23 +240,36 @@ public:
                 attempt += 1;
                 pat.clearHistory();
                 pat.decache();
-                pat.advance(0, 0, 10000);
+                pat.advance(params.rule, 0, 10000);
                 duration = 4000;
             }
         }
     }
 
 
-    std::vector<std::pair<long long, std::string> > getSortedList(long long &totobjs) {
+    // A line of the census table, which is sorted by count and then apgcode:
+    struct CensusEntry {
+        long long count;
+        std::string apgcode;
+        uint32_t id;
+
+        bool operator<(const CensusEntry &other) const {
+            if (count != other.count) { return (count < other.count); }
+            return (apgcode < other.apgcode);
+        }
+    };
+
+    std::vector<CensusEntry> getSortedList(long long &totobjs) {
 
-        std::vector<std::pair<long long, std::string> > censusList;
+        // The census is kept by ID; each apgcode is resolved once, here:
+        static const uint32_t emptyId = apg::apgcodes.intern("xs0_0");
+        std::vector<CensusEntry> censusList;
 
-        std::map<std::string, long long>::iterator it;
-        for (it = census.begin(); it != census.end(); it++)
-        {
-            if ((it->second != 0) && (it->first != "xs0_0")) {
-                censusList.push_back(std::make_pair(it->second, it->first));
-                totobjs += it->second;
+        for (unsigned int id = 0; id < census.counts.size(); id++) {
+            if ((census.counts[id] != 0) && (id != emptyId)) {
+                CensusEntry entry = {census.counts[id], apg::apgcodes.apgcode(id), id};
+                censusList.push_back(entry);
+                totobjs += census.counts[id];
             }
         }
         std::sort(censusList.begin(), censusList.end());
@@ -179,30 +282,30 @@ public:
 
         long long totobjs = 0;
 
-        std::vector<std::pair<long long, std::string> > censusList = getSortedList(totobjs);
+        std::vector<CensusEntry> censusList = getSortedList(totobjs);
 
         std::ostringstream ss;
 
         ss << "@VERSION " << APG_VERSION << "\n";
         ss << "@MD5 " << md5(root) << "\n";
         ss << "@ROOT " << root << "\n";
-        ss << "@RULE " << RULESTRING << "\n";
-        ss << "@SYMMETRY " << SYMMETRY << "\n";
+        ss << "@RULE " << params.rulestring << "\n";
+        ss << "@SYMMETRY " << params.symmetry << "\n";
         ss << "@NUM_SOUPS " << numsoups << "\n";
         ss << "@NUM_OBJECTS " << totobjs << "\n";
 
         ss << "\n@CENSUS TABLE\n";
 
         for (int i = censusList.size() - 1; i >= 0; i--) {
-            ss << censusList[i].second << " " << censusList[i].first << "\n";
+            ss << censusList[i].apgcode << " " << censusList[i].count << "\n";
         }
 
         ss << "\n@SAMPLE_SOUPIDS\n";
 
         for (int i = censusList.size() - 1; i >= 0; i--) {
-            std::vector<std::string> occurrences = alloccur[censusList[i].second];
+            std::vector<std::string> &occurrences = census.occurrences[censusList[i].id];
 
-            ss << censusList[i].second;
+            ss << censusList[i].apgcode;
 
             for (unsigned int j = 0; j < occurrences.size(); j++) {
                 ss << " " << occurrences[j];
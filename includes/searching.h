@@ -3,6 +3,13 @@
 #include <stdio.h>
 #include <sys/select.h>
 
+#ifdef USE_OPEN_MP
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#endif
+
 // determine whether there's a keystroke waiting
 int keyWaiting() {
     struct timeval tv;
@@ -19,81 +26,363 @@ int keyWaiting() {
     return FD_ISSET(STDIN_FILENO, &fds);
 }
 
-void populateLuts() {
+template<typename UPATTERN>
+void populateLuts(const SearchParams &params) {
 
-        apg::bitworld bw = apg::hashsoup("", SYMMETRY);
+        apg::bitworld bw = apg::hashsoup("", params.symmetry);
         std::vector<apg::bitworld> vbw;
         vbw.push_back(bw);
         UPATTERN pat;
         pat.insertPattern(vbw);
-        pat.advance(0, 0, 8);
+        pat.advance(params.rule, 0, 8);
 
 }
 
+// Start with the objects classified by earlier runs, if there is a cache file:
+void openObjectCache(apg::object_cache &objects, const SearchParams &params) {
+
+    if (params.cachefile.empty()) { return; }
+
+    int64_t loaded = objects.open(params.cachefile, params.rulestring);
+    if (loaded < 0) {
+        std::cout << "\033[1;31mWarning: unable to open object cache " << params.cachefile << "\033[0m" << std::endl;
+    } else {
+        std::cout << "Loaded " << loaded << " entries from object cache " << params.cachefile << std::endl;
+    }
+}
+
 #ifdef USE_OPEN_MP
 
-bool parallelSearch(int n, int m, std::string seed) {
+/*
+ * Hands out batches of soups to worker threads. Each worker has a deque
+ * of batches (a contiguous range, consumed from the front), and a worker
+ * whose deque is empty steals the back half of the fullest deque. Thus a
+ * thread which is held up by a pathological soup does not leave the rest
+ * idle at the end of a haul, as happened with '#pragma omp for'.
+ *
+ * Hauls are numbered by epoch. Once every batch of a haul has been handed
+ * out, the next haul (with the next seed) is dealt to the deques, so that
+ * workers never wait for stragglers at a haul boundary.
+ */
+class SoupScheduler {
+
+    struct SoupDeque {
+        long long epoch;
+        long long front;
+        long long back;
+        omp_lock_t lock;
+        char padding[64]; // keep the deques on separate cache lines
+    };
+
+    std::vector<SoupDeque> deques;
+    std::vector<std::string> seeds;
+    long long soupsPerHaul;
+    long long maxEpochs; // zero for an endless search
+    omp_lock_t lock; // serialises stealing and dealing
+
+    bool pop(SoupDeque &deque, long long &epoch, long long &batch) {
+        bool success = false;
+        omp_set_lock(&(deque.lock));
+        if (deque.front < deque.back) {
+            epoch = deque.epoch;
+            batch = deque.front++;
+            success = true;
+        }
+        omp_unset_lock(&(deque.lock));
+        return success;
+    }
 
-    SoupSearcher globalSoup;
+    // Steal the back half of the fullest deque:
+    bool steal(int worker) {
+
+        // A new haul may have been dealt since this worker's deque ran dry:
+        omp_set_lock(&(deques[worker].lock));
+        bool replenished = (deques[worker].front < deques[worker].back);
+        omp_unset_lock(&(deques[worker].lock));
+        if (replenished) { return true; }
+
+        int victim = -1;
+        long long most = 0;
+        for (unsigned int i = 0; i < deques.size(); i++) {
+            omp_set_lock(&(deques[i].lock));
+            long long remaining = deques[i].back - deques[i].front;
+            omp_unset_lock(&(deques[i].lock));
+            if (remaining > most) { most = remaining; victim = i; }
+        }
+        if (victim < 0) { return false; }
+
+        long long epoch, stolenFront, stolenBack;
+        omp_set_lock(&(deques[victim].lock));
+        epoch = deques[victim].epoch;
+        stolenBack = deques[victim].back;
+        stolenFront = stolenBack - (stolenBack - deques[victim].front + 1) / 2;
+        deques[victim].back = stolenFront;
+        omp_unset_lock(&(deques[victim].lock));
+
+        omp_set_lock(&(deques[worker].lock));
+        deques[worker].epoch = epoch;
+        deques[worker].front = stolenFront;
+        deques[worker].back = stolenBack;
+        omp_unset_lock(&(deques[worker].lock));
+        return true;
+    }
 
-    long long offset = 0;
-    bool finishedSearch = false;
+    // Divide a haul evenly between the workers:
+    void deal(std::string seed) {
 
-    // Ensure the lookup tables are populated by the main thread:
-    populateLuts();
+        long long epoch = seeds.size();
+        seeds.push_back(seed);
+
+        long long batches = (soupsPerHaul + SOUP_BATCH - 1) / SOUP_BATCH;
+        int workers = deques.size();
+        for (int i = 0; i < workers; i++) {
+            omp_set_lock(&(deques[i].lock));
+            deques[i].epoch = epoch;
+            deques[i].front = (batches * i) / workers;
+            deques[i].back = (batches * (i + 1)) / workers;
+            omp_unset_lock(&(deques[i].lock));
+        }
+    }
 
-    while (finishedSearch == false) {
+    // Start the next haul once every batch of this one has been handed out:
+    bool advance() {
+        if ((maxEpochs != 0) && (((long long) seeds.size()) >= maxEpochs)) { return false; }
+        std::string seed = reseed(seeds.back());
+        std::cout << "Using seed " << seed << std::endl;
+        deal(seed);
+        return true;
+    }
 
-        #pragma omp parallel num_threads(m)
-        {
-            int threadNumber = omp_get_thread_num();
+public:
 
-            SoupSearcher localSoup;
-            apg::lifetree<uint32_t, BITPLANES> lt(400);
-            apg::base_classifier<BITPLANES> cfier(&lt, RULESTRING);
+    SoupScheduler(int workers, long long soupsPerHaul, std::string seed, long long maxEpochs) : deques(workers) {
+        this->soupsPerHaul = soupsPerHaul;
+        this->maxEpochs = maxEpochs;
+        omp_init_lock(&lock);
+        for (int i = 0; i < workers; i++) {
+            omp_init_lock(&(deques[i].lock));
+        }
+        deal(seed);
+    }
 
-            long long elapsed = 0;
+    ~SoupScheduler() {
+        for (unsigned int i = 0; i < deques.size(); i++) {
+            omp_destroy_lock(&(deques[i].lock));
+        }
+        omp_destroy_lock(&lock);
+    }
 
-            #pragma omp for
-            for (long long i = offset; i < offset + n; i++) {
-                long long pseudoElapsed = offset + elapsed * m + threadNumber;
-                elapsed += 1;
-                if (pseudoElapsed % 10000 == 0) {
-                    std::cout << pseudoElapsed << " soups processed..." << std::endl;
-                }
-                std::ostringstream ss;
-                ss << i;
-                localSoup.censusSoup(seed, ss.str(), cfier);
+    std::string seed(long long epoch) {
+        omp_set_lock(&lock);
+        std::string s = seeds[epoch];
+        omp_unset_lock(&lock);
+        return s;
+    }
+
+    long long lastEpoch() {
+        omp_set_lock(&lock);
+        long long epoch = seeds.size() - 1;
+        omp_unset_lock(&lock);
+        return epoch;
+    }
+
+    // Fetch the next batch for a worker, returning false once the search is over:
+    bool next(int worker, long long &epoch, long long &start, int &batchsize) {
+
+        long long batch = 0;
+
+        while (!pop(deques[worker], epoch, batch)) {
+            omp_set_lock(&lock);
+            bool more = steal(worker) || advance();
+            omp_unset_lock(&lock);
+            if (!more) { return false; }
+        }
+
+        start = batch * SOUP_BATCH;
+        batchsize = (soupsPerHaul - start < SOUP_BATCH) ? (soupsPerHaul - start) : SOUP_BATCH;
+        return true;
+    }
+
+};
+
+/*
+ * Merges and logs finished hauls on a background thread while the workers
+ * carry on with the next one. A worker submits its census for a haul when
+ * it moves on to a later haul; once every worker has done so, the haul is
+ * complete and is queued for logging.
+ */
+template<int BITPLANES, typename UPATTERN>
+class HaulPipeline {
+
+    struct HaulSnapshot {
+        std::string seed;
+        std::vector<SoupCensus> censuses;
+    };
+
+    SoupSearcher<BITPLANES, UPATTERN> globalSoup;
+    long long soupsPerHaul;
+    int workers;
+
+    std::map<long long, HaulSnapshot> pending;
+    std::deque<HaulSnapshot> completed;
+    bool finished;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::thread logger;
+
+    void logHauls() {
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            ready.wait(lock, [this] { return finished || !completed.empty(); });
+            if (completed.empty()) { return; }
+            HaulSnapshot snapshot = std::move(completed.front());
+            completed.pop_front();
+            lock.unlock();
+
+            for (unsigned int i = 0; i < snapshot.censuses.size(); i++) {
+                globalSoup.aggregate(snapshot.censuses[i]);
             }
 
-            #pragma omp critical
-            {
+            std::cout << "----------------------------------------------------------------------" << std::endl;
+            std::cout << soupsPerHaul << " soups completed." << std::endl;
+            globalSoup.logResults(snapshot.seed, soupsPerHaul);
+            globalSoup.census.clear();
+            std::cout << "----------------------------------------------------------------------" << std::endl;
+
+            lock.lock();
+        }
+    }
+
+public:
+
+    HaulPipeline(const SearchParams &params, long long soupsPerHaul, int workers) : globalSoup(params) {
+        this->soupsPerHaul = soupsPerHaul;
+        this->workers = workers;
+        finished = false;
+        logger = std::thread(&HaulPipeline::logHauls, this);
+    }
+
+    // Hand over a worker's census for the given haul, leaving it empty:
+    void submit(long long epoch, std::string seed, SoupSearcher<BITPLANES, UPATTERN> &localSoup) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        HaulSnapshot &snapshot = pending[epoch];
+        snapshot.seed = seed;
+        snapshot.censuses.push_back(std::move(localSoup.census));
+        localSoup.census.clear();
+
+        if (((int) snapshot.censuses.size()) == workers) {
+            completed.push_back(std::move(snapshot));
+            pending.erase(epoch);
+            ready.notify_one();
+        }
+    }
+
+    // Wait until every completed haul has been logged:
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+        }
+        ready.notify_one();
+        logger.join();
+    }
+
+};
+
+/*
+ * Runs hauls of n soups on m threads until the search is finished (after
+ * one haul when testing). The threads, and their lifetrees and classifiers,
+ * persist from one haul to the next; the classifiers share a cache of the
+ * objects they have separated.
+ */
+template<int BITPLANES, typename UPATTERN>
+bool parallelSearch(int n, int m, std::string seed, const SearchParams &params, bool testing) {
+
+    SoupScheduler scheduler(m, n, seed, testing ? 1 : 0);
+    HaulPipeline<BITPLANES, UPATTERN> *pipeline = 0;
+
+    // Objects separated by any thread are remembered for all of them:
+    apg::object_cache objects;
+    openObjectCache(objects, params);
+
+    long long processed = 0;
+
+    // Ensure the lookup tables are populated by the main thread:
+    populateLuts<UPATTERN>(params);
+
+    std::cout << "Using seed " << seed << std::endl;
+
+    #pragma omp parallel num_threads(m)
+    {
+        int threadNumber = omp_get_thread_num();
+
+        SoupSearcher<BITPLANES, UPATTERN> localSoup(params);
+        apg::lifetree<uint32_t, BITPLANES> lt(400);
+        apg::base_classifier<BITPLANES> cfier(&lt, params.rulestring, &objects);
+
+        #pragma omp single
+        pipeline = new HaulPipeline<BITPLANES, UPATTERN>(params, n, omp_get_num_threads());
+
+        uint8_t digests[32 * SOUP_BATCH];
+        long long currentEpoch = 0;
+        std::string currentSeed = seed;
 
-                globalSoup.aggregate(&(localSoup.census), &(localSoup.alloccur));
+        long long epoch = 0;
+        long long b = 0;
+        int batchsize = 0;
 
+        while (scheduler.next(threadNumber, epoch, b, batchsize)) {
+
+            if (epoch != currentEpoch) {
+                for (; currentEpoch < epoch; currentEpoch++) {
+                    pipeline->submit(currentEpoch, scheduler.seed(currentEpoch), localSoup);
+                }
+                currentSeed = scheduler.seed(epoch);
+            }
+
+            apg::hashsoups(currentSeed, b, batchsize, digests);
+            for (int j = 0; j < batchsize; j++) {
+                long long soupsDone;
+                #pragma omp atomic capture
+                soupsDone = processed++;
+                if (soupsDone % 10000 == 0) {
+                    #pragma omp critical
+                    std::cout << soupsDone << " soups processed..." << std::endl;
+                }
+                std::ostringstream ss;
+                ss << (b + j);
+                localSoup.censusSoup(digests + 32 * j, ss.str(), cfier);
             }
         }
 
-        offset += n;
-        std::cout << "----------------------------------------------------------------------" << std::endl;
-        std::cout << offset << " soups completed." << std::endl;
-        globalSoup.logResults(seed, offset);
-        std::cout << "Starting new search..." << std::endl;
-        finishedSearch = true;
-        std::cout << "----------------------------------------------------------------------" << std::endl;
+        long long lastEpoch = scheduler.lastEpoch();
+        for (; currentEpoch <= lastEpoch; currentEpoch++) {
+            pipeline->submit(currentEpoch, scheduler.seed(currentEpoch), localSoup);
+        }
     }
-    
+
+    pipeline->finish();
+    delete pipeline;
+
     return false;
 
 }
 
 #endif
 
-bool runSearch(int n, std::string seed) {
+template<int BITPLANES, typename UPATTERN>
+bool runSearch(int n, std::string seed, const SearchParams &params) {
 
-    SoupSearcher soup;
+    SoupSearcher<BITPLANES, UPATTERN> soup(params);
+    apg::object_cache objects;
+    openObjectCache(objects, params);
     apg::lifetree<uint32_t, BITPLANES> lt(400);
-    apg::base_classifier<BITPLANES> cfier(&lt, RULESTRING);
+    apg::base_classifier<BITPLANES> cfier(&lt, params.rulestring, &objects);
 
     clock_t start = clock();
 
@@ -102,15 +391,25 @@ bool runSearch(int n, std::string seed) {
     int64_t i = 0;
     int64_t lasti = 0;
 
+    // Soups are hashed SOUP_BATCH at a time, starting at soup number batchstart:
+    int64_t batchstart = 0;
+    uint8_t digests[32 * SOUP_BATCH];
+    apg::hashsoups(seed, batchstart, SOUP_BATCH, digests);
+
     bool finishedSearch = false;
     bool quitByUser = false;
 
     while ((finishedSearch == false) && (quitByUser == false)) {
 
+        if (i == batchstart + SOUP_BATCH) {
+            batchstart = i;
+            apg::hashsoups(seed, batchstart, SOUP_BATCH, digests);
+        }
+
         std::ostringstream ss;
         ss << i;
 
-        soup.censusSoup(seed, ss.str(), cfier);
+        soup.censusSoup(digests + 32 * (i - batchstart), ss.str(), cfier);
 
         i += 1;
 
@@ -144,4 +443,42 @@ bool runSearch(int n, std::string seed) {
 
 }
 
+/*
+ * Runs hauls until the user quits (or after one haul when testing). This
+ * is passed to withRule() in params.h, which instantiates run() with the
+ * types appropriate to the chosen rule:
+ */
+struct SearchLauncher {
+
+    SearchParams params;
+    int soups_per_haul;
+    int parallelisation;
+    std::string seed;
+    bool testing;
+
+    SearchLauncher(const SearchParams &params) : params(params) { }
+
+    template<int BITPLANES, typename UPATTERN>
+    bool run() {
+
+        #ifdef USE_OPEN_MP
+        if (parallelisation > 0) {
+            return parallelSearch<BITPLANES, UPATTERN>(soups_per_haul, parallelisation, seed, params, testing);
+        }
+        #endif
+
+        bool quitByUser = false;
+
+        while (!quitByUser) {
+            // Run the search:
+            std::cout << "Using seed " << seed << std::endl;
+            quitByUser = runSearch<BITPLANES, UPATTERN>(soups_per_haul, seed, params);
+            seed = reseed(seed);
+
+            if (testing) { break; }
+        }
+
+        return quitByUser;
+    }
 
+};
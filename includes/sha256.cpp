@@ -39,6 +39,10 @@
 #include <fstream>
 #include "sha256.h"
 
+#ifdef __SHA__
+#include <immintrin.h>
+#endif
+
 const unsigned int SHA256::sha256_k[64] = //UL = uint32
             {0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
              0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
@@ -59,6 +63,10 @@ const unsigned int SHA256::sha256_k[64] = //UL = uint32
 
 void SHA256::transform(const unsigned char *message, unsigned int block_nb)
 {
+#ifdef __SHA__
+    transform_ni(message, block_nb);
+    return;
+#endif
     uint32 w[64];
     uint32 wv[8];
     uint32 t1, t2;
@@ -167,3 +175,174 @@ std::string sha256(std::string input)
         sprintf(buf+i*2, "%02x", digest[i]);
     return std::string(buf);
 }
+
+/*
+ * Number of messages hashed in parallel by SHA256::batch. The lanes are
+ * GCC vector extensions, which compile to SSE2, AVX2 or AVX-512 code
+ * depending on the -march flags:
+ */
+#if defined(__AVX512F__)
+#define SHA256_LANES 16
+#elif defined(__AVX2__)
+#define SHA256_LANES 8
+#else
+#define SHA256_LANES 4
+#endif
+
+typedef unsigned int sha256_vec __attribute__((vector_size(4 * SHA256_LANES)));
+
+static inline sha256_vec sha256_vrotr(sha256_vec x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+void SHA256::transform_lanes(const unsigned char *blocks, const unsigned int *block_nb,
+                             unsigned int lanes, unsigned char *digests)
+{
+    /*
+    * blocks contains SHA256_LANES padded messages of 128 bytes each, of
+    * which the first block_nb[l] blocks are meaningful. Lanes run in
+    * lockstep; each digest is taken once its lane has run out of blocks.
+    */
+    const uint32 h0[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                          0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    sha256_vec h[8];
+    sha256_vec w[64];
+    sha256_vec wv[8];
+    sha256_vec t1, t2;
+    uint32 word;
+    unsigned int max_nb = 0;
+    int j;
+    for (unsigned int l = 0; l < lanes; l++) {
+        if (block_nb[l] > max_nb) { max_nb = block_nb[l]; }
+    }
+    for (j = 0; j < 8; j++) {
+        h[j] = ((sha256_vec) {}) + h0[j];
+    }
+    for (unsigned int i = 0; i < max_nb; i++) {
+        for (j = 0; j < 16; j++) {
+            for (unsigned int l = 0; l < SHA256_LANES; l++) {
+                SHA2_PACK32(blocks + (l << 7) + (i << 6) + (j << 2), &word);
+                w[j][l] = word;
+            }
+        }
+        for (j = 16; j < 64; j++) {
+            w[j] = (sha256_vrotr(w[j - 2], 17) ^ sha256_vrotr(w[j - 2], 19) ^ (w[j - 2] >> 10))
+                 + w[j - 7]
+                 + (sha256_vrotr(w[j - 15], 7) ^ sha256_vrotr(w[j - 15], 18) ^ (w[j - 15] >> 3))
+                 + w[j - 16];
+        }
+        for (j = 0; j < 8; j++) {
+            wv[j] = h[j];
+        }
+        for (j = 0; j < 64; j++) {
+            t1 = wv[7] + (sha256_vrotr(wv[4], 6) ^ sha256_vrotr(wv[4], 11) ^ sha256_vrotr(wv[4], 25))
+               + SHA2_CH(wv[4], wv[5], wv[6]) + sha256_k[j] + w[j];
+            t2 = (sha256_vrotr(wv[0], 2) ^ sha256_vrotr(wv[0], 13) ^ sha256_vrotr(wv[0], 22))
+               + SHA2_MAJ(wv[0], wv[1], wv[2]);
+            wv[7] = wv[6];
+            wv[6] = wv[5];
+            wv[5] = wv[4];
+            wv[4] = wv[3] + t1;
+            wv[3] = wv[2];
+            wv[2] = wv[1];
+            wv[1] = wv[0];
+            wv[0] = t1 + t2;
+        }
+        for (j = 0; j < 8; j++) {
+            h[j] += wv[j];
+        }
+        for (unsigned int l = 0; l < lanes; l++) {
+            if (block_nb[l] == i + 1) {
+                for (j = 0; j < 8; j++) {
+                    SHA2_UNPACK32(h[j][l], digests + (l << 5) + (j << 2));
+                }
+            }
+        }
+    }
+}
+
+void SHA256::batch(const unsigned char* const* messages, const unsigned int* lengths,
+                   unsigned int n, unsigned char* digests)
+{
+#if defined(__SHA__) && !defined(__AVX512F__)
+    // The SHA extensions beat four or eight vector lanes:
+    for (unsigned int i = 0; i < n; i++) {
+        SHA256 ctx = SHA256();
+        ctx.init();
+        ctx.update(messages[i], lengths[i]);
+        ctx.final(digests + (i << 5));
+    }
+#else
+    unsigned char blocks[SHA256_LANES << 7];
+    unsigned int block_nb[SHA256_LANES];
+
+    for (unsigned int i = 0; i < n; i += SHA256_LANES) {
+        unsigned int lanes = (n - i < SHA256_LANES) ? (n - i) : SHA256_LANES;
+        memset(blocks, 0, sizeof(blocks));
+        for (unsigned int l = 0; l < lanes; l++) {
+            unsigned int len = lengths[i + l];
+            if (len > 2 * SHA224_256_BLOCK_SIZE - 9) {
+                // Too long to pad into two blocks; hash it on its own:
+                SHA256 ctx = SHA256();
+                ctx.init();
+                ctx.update(messages[i + l], len);
+                ctx.final(digests + ((i + l) << 5));
+                block_nb[l] = 0;
+                continue;
+            }
+            unsigned char *block = blocks + (l << 7);
+            block_nb[l] = (len > SHA224_256_BLOCK_SIZE - 9) ? 2 : 1;
+            memcpy(block, messages[i + l], len);
+            block[len] = 0x80;
+            SHA2_UNPACK32(len << 3, block + (block_nb[l] << 6) - 4);
+        }
+        for (unsigned int l = lanes; l < SHA256_LANES; l++) {
+            block_nb[l] = 0;
+        }
+        transform_lanes(blocks, block_nb, lanes, digests + (i << 5));
+    }
+#endif
+}
+
+#ifdef __SHA__
+void SHA256::transform_ni(const unsigned char *message, unsigned int block_nb)
+{
+    /*
+    * The SHA extensions keep the working variables in two registers,
+    * ABEF and CDGH, and perform two rounds per sha256rnds2 instruction.
+    */
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) m_h), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) (m_h + 4)), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (unsigned int i = 0; i < block_nb; i++) {
+        const unsigned char *sub_block = message + (i << 6);
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+        __m128i msgs[4];
+        for (int j = 0; j < 16; j++) {
+            __m128i msg;
+            if (j < 4) {
+                msg = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (sub_block + (j << 4))), mask);
+            } else {
+                msg = _mm_sha256msg1_epu32(msgs[j & 3], msgs[(j + 1) & 3]);
+                msg = _mm_add_epi32(msg, _mm_alignr_epi8(msgs[(j + 3) & 3], msgs[(j + 2) & 3], 4));
+                msg = _mm_sha256msg2_epu32(msg, msgs[(j + 3) & 3]);
+            }
+            msgs[j & 3] = msg;
+            msg = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*) (sha256_k + (j << 2))));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i*) m_h, _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i*) (m_h + 4), _mm_alignr_epi8(state1, tmp, 8));
+}
+#endif
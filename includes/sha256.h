@@ -17,8 +17,22 @@ public:
     void final(unsigned char *digest);
     static const unsigned int DIGEST_SIZE = ( 256 / 8);
 
+    /*
+    * Hash n independent messages, writing the digest of messages[i] to
+    * digests + DIGEST_SIZE * i. Short messages are hashed several at a
+    * time, one per SIMD lane, which is much faster than n separate calls
+    * to init/update/final.
+    */
+    static void batch(const unsigned char* const* messages, const unsigned int* lengths,
+                      unsigned int n, unsigned char* digests);
+
 protected:
     void transform(const unsigned char *message, unsigned int block_nb);
+    static void transform_lanes(const unsigned char *blocks, const unsigned int *block_nb,
+                                unsigned int lanes, unsigned char *digests);
+#ifdef __SHA__
+    void transform_ni(const unsigned char *message, unsigned int block_nb);
+#endif
     unsigned int m_tot_len;
     unsigned int m_len;
     unsigned char m_block[2*SHA224_256_BLOCK_SIZE];
@@ -1,9 +1,11 @@
 #pragma once
+#include <unordered_map>
 
 /*
  * Stabilisation detection by checking for population periodicity:
  */
-int naivestab_awesome(UPATTERN &pat) {
+template<typename U>
+int naivestab_awesome(U &pat, int rule) {
 
     // Copied almost verbatim from the apgsearch Python script...
     int depth = 0;
@@ -28,7 +30,7 @@ int naivestab_awesome(UPATTERN &pat) {
         if (i == 400)
             period = 30;
 
-        pat.advance(0, 0, period);
+        pat.advance(rule, 0, period);
         currpop = pat.totalPopulation();
         if (currpop == prevpop) {
             depth += 1;
@@ -36,7 +38,7 @@ int naivestab_awesome(UPATTERN &pat) {
             depth = 0;
             if (period < 30) {
                 i += 1;
-                pat.advance(0, 0, 12);
+                pat.advance(rule, 0, 12);
             }
         }
         prevpop = currpop;
@@ -53,68 +55,74 @@ int naivestab_awesome(UPATTERN &pat) {
 /*
  * Run the universe until it stabilises:
  */
-int stabilise3(UPATTERN &pat) {
+template<typename U>
+int stabilise3(U &pat, int rule) {
 
-    int pp = naivestab_awesome(pat);
+    int pp = naivestab_awesome(pat, rule);
 
     if (pp > 0) {
         return pp;
     }
 
-    // Phase II of stabilisation detection, which is much more rigorous and based on oscar.py.
-
+    /*
+    * Phase II of stabilisation detection, which is much more rigorous and
+    * based on oscar.py: look for the first repeat of the hash of the
+    * universe (near the origin, so that escaping spaceships are ignored)
+    * after every pair of generations. The upattern keeps that hash as a
+    * running sum over its tiles, so each sample only rehashes the tiles
+    * which changed. A repeat only becomes the period once the whole cycle
+    * after it has matched as well.
+    */
+
+    std::unordered_map<uint64_t, int> lastseen;
     std::vector<uint64_t> hashlist;
-    std::vector<int> genlist;
-
-    int generation = 0;
-
-    for (int j = 0; j < 4000; j++) {
+    int candidate = 0;
+    int matched = 0;
 
-        pat.advance(0, 0, 30);
-        generation += 30;
+    for (int step = 0; step < 60000; step++) {
 
+        pat.advance(rule, 0, 2);
         uint64_t h = pat.totalHash(120);
+        hashlist.push_back(h);
 
-        // determine where to insert h into hashlist
-        int pos = 0;
-        int listlen = hashlist.size();
-
-        while (pos < listlen) {
-            if (h > hashlist[pos]) {
-                pos += 1;
-            } else if (h < hashlist[pos]) {
-                // shorten lists and append info below
-                for (int i = pos; i < listlen; i++) {
-                    hashlist.pop_back();
-                    genlist.pop_back();
-                }
-                break;
-            } else {
-                int period = (generation - genlist[pos]);
-
-                int prevpop = pat.totalPopulation();
-
-                for (int i = 0; i < 20; i++) {
-                    pat.advance(0, 0, period);
-                    int currpop = pat.totalPopulation();
-                    if (currpop != prevpop) {
-                        if (period < 1280) { period = 1280; }
-                        break;
-                    }
-                    prevpop = currpop;
+        if ((candidate > 0) && (hashlist[step - candidate] == h)) {
+            matched += 1;
+        } else {
+            auto it = lastseen.find(h);
+            candidate = (it == lastseen.end()) ? 0 : (step - it->second);
+            matched = (candidate > 0) ? 1 : 0;
+        }
+        lastseen[h] = step;
+
+        if ((candidate > 0) && (matched > candidate)) {
+
+            // The old phase II sampled every 30 generations, so it always
+            // returned a multiple of 30 and stopped on that 30-generation
+            // grid. Keep both, as the period becomes the length of history
+            // over which objects are separated, and objects may be
+            // separated differently in different phases:
+            int period = apg::euclid_lcm(2 * candidate, 30);
+            int overshoot = (2 * (step + 1)) % 30;
+            if (overshoot) { pat.advance(rule, 0, 30 - overshoot); }
+            int prevpop = pat.totalPopulation();
+
+            for (int i = 0; i < 20; i++) {
+                pat.advance(rule, 0, period);
+                int currpop = pat.totalPopulation();
+                if (currpop != prevpop) {
+                    if (period < 1280) { period = 1280; }
+                    break;
                 }
-
-                return period;
+                prevpop = currpop;
             }
-        }
 
-        hashlist.push_back(h);
-        genlist.push_back(generation);
+            return period;
+        }
     }
 
     std::cout << "Failed to detect periodic behaviour!" << std::endl;
 
-    pat.advance(0, 0, 1280);
+    pat.advance(rule, 0, 1280);
 
     return 1280;
 
@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+
+namespace apg {
+
+    /*
+    * Interns apgcodes as 32-bit IDs, which stay valid for the lifetime of
+    * the process and are shared by every thread. The table is split into
+    * 64 shards by hash, each with its own lock, and the low six bits of an
+    * ID name its shard; so threads interning different apgcodes rarely
+    * contend, and IDs are issued densely enough to index flat arrays.
+    */
+    class apgcode_table {
+
+        struct shard {
+            std::mutex mutex;
+            std::unordered_map<std::string, uint32_t> ids;
+            std::vector<std::string> apgcodes;
+        };
+
+        shard shards[64];
+
+    public:
+
+        uint32_t intern(const std::string &apgcode) {
+
+            size_t h = std::hash<std::string>()(apgcode);
+            uint32_t s = (h ^ (h >> 6) ^ (h >> 12)) & 63;
+            shard &sh = shards[s];
+
+            std::lock_guard<std::mutex> lock(sh.mutex);
+            auto it = sh.ids.find(apgcode);
+            if (it != sh.ids.end()) { return it->second; }
+
+            uint32_t id = (sh.apgcodes.size() << 6) | s;
+            sh.ids.emplace(apgcode, id);
+            sh.apgcodes.push_back(apgcode);
+            return id;
+        }
+
+        std::string apgcode(uint32_t id) {
+            shard &sh = shards[id & 63];
+            std::lock_guard<std::mutex> lock(sh.mutex);
+            return sh.apgcodes[id >> 6];
+        }
+
+    };
+
+    apgcode_table apgcodes;
+
+}
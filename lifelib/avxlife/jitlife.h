@@ -0,0 +1,472 @@
+#pragma once
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+#include "lifeperm.h"
+#include "eors.h"
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__) || defined(__CYGWIN__))
+#include <sys/mman.h>
+#define LIFELIB_JIT 1
+#endif
+
+/*
+* Just-in-time kernels for life-like (outer-totalistic B/S) rules which
+* were not passed to rule2asm.py. The logic circuit is built from the
+* same pre- and post-processing gates as rule2asm's genlogic, with the
+* core four-input function synthesised by Shannon expansion instead of
+* being looked up in boolean.out. The emitted code computes one
+* generation of a block of rows with AVX2; the bookkeeping around it
+* (history, masking, diffs) mirrors the generated iterate_*_32_28.
+*/
+
+namespace apg {
+namespace jit {
+
+    // Computes e[i] = next(d)[i+1] for 0 <= i < rows - 2:
+    typedef void (__attribute__((sysv_abi)) *stepfn)(const uint32_t* d, uint32_t* e);
+
+    /*
+    * The handful of VEX-encoded AVX2 instructions needed by the kernels.
+    * Memory operands are [rdi + disp8] (source rows) or [rsi + disp8]
+    * (destination rows).
+    */
+    class x86emitter {
+
+        void vex(int pp, int reg, int vvvv, int rm) {
+            code.push_back(0xc4);
+            code.push_back((((~reg >> 3) & 1) << 7) | (1 << 6) | (((~rm >> 3) & 1) << 5) | 1);
+            code.push_back(((~vvvv & 15) << 3) | 4 | pp);
+        }
+
+        void rrr(uint8_t opcode, int dst, int src1, int src2) {
+            vex(1, dst, src1, src2);
+            code.push_back(opcode);
+            code.push_back(0xc0 | ((dst & 7) << 3) | (src2 & 7));
+        }
+
+        void mem(uint8_t opcode, int reg, int base, int offset) {
+            vex(2, reg, 0, 0);
+            code.push_back(opcode);
+            code.push_back(0x40 | ((reg & 7) << 3) | base);
+            code.push_back((uint8_t) offset);
+        }
+
+        void shift(int ext, int dst, int src, int imm) {
+            vex(1, 0, dst, src);
+            code.push_back(0x72);
+            code.push_back(0xc0 | (ext << 3) | (src & 7));
+            code.push_back((uint8_t) imm);
+        }
+
+    public:
+
+        std::vector<uint8_t> code;
+
+        void load(int dst, int row) { mem(0x6f, dst, 7, 4 * row); }
+        void store(int src, int row) { mem(0x7f, src, 6, 4 * row); }
+
+        void psrld(int dst, int src, int imm) { shift(2, dst, src, imm); }
+        void pslld(int dst, int src, int imm) { shift(6, dst, src, imm); }
+
+        void pand(int dst, int a, int b) { rrr(0xdb, dst, a, b); }
+        void pandn(int dst, int a, int b) { rrr(0xdf, dst, a, b); } // dst = ~a & b
+        void por(int dst, int a, int b) { rrr(0xeb, dst, a, b); }
+        void pxor(int dst, int a, int b) { rrr(0xef, dst, a, b); }
+        void zeros(int dst) { rrr(0xef, dst, dst, dst); }
+        void ones(int dst) { rrr(0x76, dst, dst, dst); }
+
+        void ret() {
+            code.push_back(0xc5); code.push_back(0xf8); code.push_back(0x77); // vzeroupper
+            code.push_back(0xc3);
+        }
+    };
+
+    /*
+    * Boolean circuit for a B/S rule, with the same register assignment
+    * as genlogic: on entry ymm10, ymm8, ymm9 hold bits 0, 1, 2 of the
+    * neighbourhood count (shared with ymm11 until the opening gates are
+    * applied) and ymm12 holds the centre cell.
+    */
+    class rulelogic {
+
+        int bee[10];
+        int ess[10];
+        bool negate;
+        bool beexor;
+        bool essxor;
+        uint32_t ruleint;
+
+        x86emitter* em;
+        bool busy[16];
+
+        int alloc() {
+            static const int pool[] = {0, 1, 2, 3, 4, 5, 6, 7, 13, 14, 15};
+            for (int i = 0; i < 11; i++) {
+                if (!busy[pool[i]]) { busy[pool[i]] = true; return pool[i]; }
+            }
+            return -1; // depth-4 circuits need at most five temporaries
+        }
+
+        bool temporary(int r) { return (r != 8) && (r != 9) && (r != 10) && (r != 12); }
+
+        int combine(void (x86emitter::*op)(int, int, int), int a, int b) {
+            int dst = temporary(a) ? a : (temporary(b) ? b : alloc());
+            (em->*op)(dst, a, b);
+            if (temporary(a) && (a != dst)) { busy[a] = false; }
+            if (temporary(b) && (b != dst)) { busy[b] = false; }
+            return dst;
+        }
+
+        // Returns a register holding the 16-entry truth table f:
+        int synth(uint32_t f) {
+
+            static const int regs[] = {10, 8, 9, 12};
+            static const uint32_t vars[] = {0xaaaa, 0xcccc, 0xf0f0, 0xff00};
+
+            if ((f == 0) || (f == 0xffff)) {
+                int r = alloc();
+                if (f) { em->ones(r); } else { em->zeros(r); }
+                return r;
+            }
+
+            int k = 3;
+            while ((((f >> (1 << k)) ^ f) & ~vars[k] & 0xffff) == 0) { k--; }
+            if (f == vars[k]) { return regs[k]; }
+
+            // Cofactors of f with respect to variable k:
+            uint32_t f0 = f & ~vars[k] & 0xffff; f0 |= (f0 << (1 << k));
+            uint32_t f1 = f & vars[k]; f1 |= (f1 >> (1 << k));
+            f0 &= 0xffff; f1 &= 0xffff;
+
+            if (f0 == 0) {
+                return combine(&x86emitter::pand, regs[k], synth(f1));
+            } else if (f1 == 0) {
+                return combine(&x86emitter::pandn, regs[k], synth(f0));
+            } else if (f1 == 0xffff) {
+                return combine(&x86emitter::por, regs[k], synth(f0));
+            } else if (f1 == (f0 ^ 0xffff)) {
+                return combine(&x86emitter::pxor, regs[k], synth(f0));
+            } else {
+                int r0 = synth(f0);
+                int r1 = synth(f1);
+                int t = alloc();
+                em->pxor(t, r0, r1);
+                em->pand(t, t, regs[k]);
+                if (temporary(r1)) { busy[r1] = false; }
+                return combine(&x86emitter::pxor, r0, t);
+            }
+        }
+
+    public:
+
+        bool valid;
+        bool b0;
+
+        rulelogic(std::string rulestring) {
+
+            std::memset(bee, 0, sizeof(bee));
+            std::memset(ess, 0, sizeof(ess));
+            valid = (rulestring.size() >= 2) && (rulestring[0] == 'b');
+
+            int birth = 2;
+            int last = -1;
+            for (unsigned int i = 0; valid && (i < rulestring.size()); i++) {
+                char c = rulestring[i];
+                if ((c == 'b') && (birth == 2)) {
+                    birth = 1; last = -1;
+                } else if ((c == 's') && (birth == 1)) {
+                    birth = 0; last = -1;
+                } else if ((c >= '0') && (c <= '8') && (c - '0' > last) && (birth != 2)) {
+                    last = c - '0';
+                    if (birth) { bee[last] = 1; } else { ess[last + 1] = 1; }
+                } else {
+                    valid = false;
+                }
+            }
+
+            // As in rule2asm.py, B0 rules are emulated by strobing:
+            valid = valid && (birth == 0) && !(bee[0] && ess[9]);
+
+            b0 = bee[0];
+            negate = bee[0];
+            beexor = (bee[0] != bee[8]);
+            essxor = (ess[1] != ess[9]);
+
+            if (negate) {
+                for (int i = 0; i < 10; i++) {
+                    bee[i] = 1 - bee[i];
+                    ess[i] = 1 - ess[i];
+                }
+            }
+
+            ess[0] = essxor ? (1 - ess[8]) : ess[8];
+
+            ruleint = 0;
+            for (int i = 0; i < 8; i++) {
+                ruleint += (bee[i] << i);
+                ruleint += (ess[i] << (i + 8));
+            }
+        }
+
+        // Emits the circuit and returns the register holding the result:
+        int emit(x86emitter &e) {
+
+            em = &e;
+            std::memset(busy, 0, sizeof(busy));
+            bool usetopbit = (essxor || beexor);
+
+            e.pand(1, 11, 8);
+            e.pxor(8, 8, 11);
+            if (beexor && !essxor) {
+                e.pand(0, 9, 1);
+                e.pandn(11, 12, 0);
+            } else if (usetopbit) {
+                e.pand(11, 9, 1);
+            }
+            if (essxor && !beexor) {
+                e.pand(11, 11, 12);
+            }
+            e.pxor(9, 9, 1);
+
+            int r = synth(ruleint);
+
+            if (usetopbit) {
+                e.pxor(10, 11, r);
+                r = 10;
+            }
+            if (negate) {
+                e.ones(11);
+                e.pxor(10, 11, r);
+                r = 10;
+            }
+            return r;
+        }
+    };
+
+    // One generation of rows d[k], d[k+1], ..., d[k+9] into e[k], ..., e[k+7]:
+    void emit_block(x86emitter &e, rulelogic &logic, int k) {
+
+        // Horizontal half-sums of the three vertically adjacent rows:
+        int inputs[3] = {5, 12, 5};
+        int sums[3] = {6, 8, 10};
+        for (int i = 0; i < 3; i++) {
+            int x = inputs[i], s = sums[i], c = sums[i] + 1;
+            e.load(x, k + i);
+            e.psrld(s, x, 1);
+            e.pslld(0, x, 1);
+            e.pand(c, s, 0);
+            e.pxor(s, s, 0);
+            e.pand(0, s, x);
+            e.pxor(s, s, x);
+            e.por(c, c, 0);
+        }
+
+        // Vertical full adders, leaving the count in (10, 8 ^ 11, 9) as
+        // expected by the opening gates of the rule circuit:
+        e.pxor(1, 6, 8);
+        e.pand(2, 6, 8);
+        e.pand(3, 1, 10);
+        e.pxor(10, 1, 10);
+        e.por(8, 2, 3);
+        e.pxor(1, 7, 9);
+        e.pand(2, 7, 9);
+        e.pand(3, 1, 11);
+        e.pxor(11, 1, 11);
+        e.por(9, 2, 3);
+
+        e.store(logic.emit(e), k);
+    }
+
+    struct jitrule {
+
+        std::string rulestring;
+        bool b0;
+        uint8_t* code;
+        size_t size;
+        stepfn step[33];
+
+        jitrule(std::string rulestring, rulelogic &logic) {
+
+            this->rulestring = rulestring;
+            b0 = logic.b0;
+
+            x86emitter e;
+            size_t offsets[33];
+
+            // Step functions for every height from 18 to 32 rows:
+            for (int rows = 18; rows <= 32; rows += 2) {
+                offsets[rows] = e.code.size();
+                for (int k = 0; k < rows - 2; k += 8) {
+                    emit_block(e, logic, (k + 10 > rows) ? (rows - 10) : k);
+                }
+                e.ret();
+            }
+
+            size = (e.code.size() + 4095) & ~((size_t) 4095);
+            code = 0;
+            std::memset(step, 0, sizeof(step));
+
+            #ifdef LIFELIB_JIT
+            void* mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) { return; }
+            std::memcpy(mem, e.code.data(), e.code.size());
+            if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+                munmap(mem, size);
+                return;
+            }
+            code = (uint8_t*) mem;
+            for (int rows = 18; rows <= 32; rows += 2) {
+                step[rows] = (stepfn) (code + offsets[rows]);
+            }
+            #endif
+        }
+
+        ~jitrule() {
+            #ifdef LIFELIB_JIT
+            if (code != 0) { munmap(code, size); }
+            #endif
+        }
+
+        bool iterate(int rows, uint32_t * __restrict__ d, uint32_t * __restrict__ e, uint32_t * __restrict__ h, uint32_t * __restrict__ j, uint32_t * __restrict__ diffs, bool onegen) {
+
+            if (h) {
+                for (int i = 0; i < rows; i++) {
+                    h[i] |= d[i];
+                }
+            }
+            if (j) {
+                for (int i = 0; i < rows; i++) {
+                    j[i] &= d[i];
+                }
+            }
+
+            step[rows](d, e);
+
+            if (h) {
+                for (int i = 1; i < rows - 1; i++) {
+                    h[i] |= (b0 ? (~e[i-1]) : e[i-1]);
+                }
+            }
+            if (j) {
+                for (int i = 1; i < rows - 1; i++) {
+                    j[i] &= e[i-1];
+                }
+            }
+            if (onegen) {
+                for (int i = 2; i < rows - 2; i++) {
+                    d[i] = e[i-1];
+                }
+                return false;
+            }
+
+            uint32_t f[32];
+            step[rows - 2](e, f);
+
+            // Only the central (rows - 4) columns are valid after two generations:
+            int width = rows - 4;
+            uint32_t mask = (0xffffffffu >> (32 - width)) << ((32 - width) >> 1);
+            uint32_t bigdiff = 0;
+            for (int i = 2; i < rows - 2; i++) {
+                uint32_t x = (f[i-2] & mask) | (d[i] & ~mask);
+                e[i] = x ^ d[i];
+                bigdiff |= e[i];
+                d[i] = x;
+            }
+
+            if (h) {
+                for (int i = 2; i < rows - 2; i++) {
+                    h[i] |= d[i];
+                }
+            }
+            if (j) {
+                for (int i = 2; i < rows - 2; i++) {
+                    j[i] &= d[i];
+                }
+            }
+            if (diffs != 0) {
+                diffs[0] = bigdiff;
+                diffs[1] = e[2] | e[3];
+                diffs[2] = e[rows-4] | e[rows-3];
+            }
+            return (bigdiff == 0);
+        }
+
+        int iterate_var(int n, uint32_t * __restrict__ d, uint32_t * __restrict__ h, uint32_t * __restrict__ j) {
+            uint32_t e[32];
+            if (n >= 7) { if (iterate(32, d, e, h, j, 0, (n == 7))) {return 8;} }
+            if (n >= 5) { if (iterate(28, d+2, e, h ? h+2 : 0, j ? j+2 : 0, 0, (n == 5))) {return 6;} }
+            if (n >= 3) { if (iterate(24, d+4, e, h ? h+4 : 0, j ? j+4 : 0, 0, (n == 3))) {return 4;} }
+            if (n >= 1) { if (iterate(20, d+6, e, h ? h+6 : 0, j ? j+6 : 0, 0, (n == 1))) {return 2;} }
+            return 0;
+        }
+
+        bool iterate_var_leaf(int n, uint64_t * inleaves, uint64_t * hleaves, uint64_t * jleaves, uint64_t * outleaf) {
+            uint32_t d[32];
+            uint32_t h[32];
+            uint32_t j[32];
+            apg::z64_to_r32_avx2(inleaves, d);
+            if (jleaves) { apg::z64_to_r32_avx2(jleaves, j); }
+            if (hleaves) { apg::z64_to_r32_avx2(hleaves, h); }
+            bool nochange = (iterate_var(n, d, hleaves ? h : 0, jleaves ? j : 0) == n);
+            apg::r32_centre_to_z64_avx2(d, outleaf);
+            if (jleaves) { apg::r32_centre_to_z64_avx2(j, outleaf + 8); }
+            if (hleaves) { apg::r32_centre_to_z64_avx2(h, outleaf + 4); }
+            return nochange;
+        }
+    };
+
+    // Rule numbers are shared with the compiled rules, so at most 8 in total:
+    jitrule* jitrules[8];
+    std::mutex jitmutex;
+
+    /*
+    * Returns the rule number of a JIT-compiled rule, compiling it if
+    * necessary. The first 'compiled' numbers belong to rule2asm's rules;
+    * -1 is returned if the rule is not life-like, no numbers remain, or
+    * the processor or platform does not support the JIT.
+    */
+    int rule2int(std::string rule, int compiled) {
+
+        std::lock_guard<std::mutex> lock(jitmutex);
+
+        int i = compiled;
+        for (; (i < 8) && (jitrules[i] != 0); i++) {
+            if (jitrules[i]->rulestring == rule) { return i; }
+        }
+
+        #ifdef LIFELIB_JIT
+        rulelogic logic(rule);
+        if ((i < 8) && logic.valid && (apg::best_instruction_set() >= 10)) {
+            jitrule* jr = new jitrule(rule, logic);
+            if (jr->code != 0) {
+                jitrules[i] = jr;
+                return i;
+            }
+            delete jr;
+        }
+        #endif
+
+        return -1;
+    }
+
+    uint64_t uli_valid_mantissa(int rule) {
+        if ((rule < 0) || (rule >= 8) || (jitrules[rule] == 0)) { return 3; }
+        return jitrules[rule]->b0 ? 5 : 255;
+    }
+
+    int iterate_var_leaf(int rule, int n, uint64_t * inleaves, uint64_t * hleaves, uint64_t * jleaves, uint64_t * outleaf) {
+        if ((rule < 0) || (rule >= 8) || (jitrules[rule] == 0)) { return -1; }
+        return jitrules[rule]->iterate_var_leaf(n, inleaves, hleaves, jleaves, outleaf);
+    }
+
+    int iterate_var_32_28(int rule, uint32_t* d, uint32_t* h, uint32_t* j, uint32_t * diffs) {
+        if ((rule < 0) || (rule >= 8) || (jitrules[rule] == 0)) { return -1; }
+        uint32_t e[32];
+        return jitrules[rule]->iterate(32, d, e, h, j, diffs, false);
+    }
+
+}
+}
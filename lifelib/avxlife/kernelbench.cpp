@@ -0,0 +1,51 @@
+/*
+* Compares the speed of the inline-assembly and intrinsics kernels
+* produced by rule2asm.py. Run 'python rule2asm.py b3s23' and then:
+*
+* g++ -O3 -march=native --std=c++11 kernelbench.cpp -o kernelbench
+*
+* Other rules can be benchmarked by adding -DRULE=<rulestring>.
+*/
+
+#include "lifelogic/iterators_all.h"
+#include <chrono>
+#include <iostream>
+
+#ifndef RULE
+#define RULE b3s23
+#endif
+
+template<typename F>
+void bench(const char* name, F iterator) {
+
+    uint32_t d[32];
+    uint32_t h[32];
+    uint32_t acc = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t t = 1; t <= 1000000; t++) {
+        for (int i = 0; i < 32; i++) {
+            d[i] = (i * 2654435761u * t) >> 3;
+            h[i] = 0;
+        }
+        iterator(8, d, h);
+        acc += d[16];
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    std::cout << name << ": " << ms << " ms (checksum " << acc << ")" << std::endl;
+}
+
+int main() {
+
+    bench("avx2 inline asm", [](int n, uint32_t* d, uint32_t* h) { return RULE::inlineasm::iterate_var_avx2(n, d, h); });
+    bench("avx2 intrinsics", [](int n, uint32_t* d, uint32_t* h) { return RULE::intrinsics::iterate_var_avx2(n, d, h); });
+
+    #ifdef __AVX512F__
+    bench("avx512 inline asm", [](int n, uint32_t* d, uint32_t* h) { return RULE::inlineasm::iterate_var_avx512(n, d, h); });
+    bench("avx512 intrinsics", [](int n, uint32_t* d, uint32_t* h) { return RULE::intrinsics::iterate_var_avx512(n, d, h); });
+    #endif
+
+    return 0;
+}
@@ -13,7 +13,99 @@ class iwriter:
 
     def printinstr(self, s):
 
-        self.f.write('        "%s \\n\\t"\n' % s)
+        if self.intrinsics:
+            self.f.write('        %s\n' % self.intrinsic(s))
+        else:
+            self.f.write('        "%s \\n\\t"\n' % s)
+
+    def intrinsic(self, s):
+        '''
+        Translate one of the instructions emitted for the avx2 or avx512
+        kernels into an equivalent C++ statement on __m256i or __m512i
+        variables named after the registers. As with VEX-encoded
+        instructions, operations on xmm registers zero the upper lanes.
+        '''
+
+        (op, args) = (s.split(' ', 1) + [''])[:2]
+        args = [a.strip() for a in args.split(',')]
+        w = 512 if ('avx512' in self.iset) else 256
+        mm = '_mm%d_' % w
+        reg = 'zmm' if (w == 512) else 'ymm'
+
+        masked = '%{' in args[-1]
+        zeroing = '%{z%}' in args[-1]
+        mask = args[-1][args[-1].find('%%k') + 2:][:2] if masked else None
+        args = [(a[:a.index('%{')] if ('%{' in a) else a) for a in args]
+
+        def operand(a):
+            if a.startswith('$'):
+                return a[1:]
+            if a.startswith('%%'):
+                return (reg + a[5:]) if (a[2] in 'xyz') else a[2:]
+            (off, base) = a[:-4], a[-3:-1]
+            base = {'%0': 'd', '%1': 'e', '%2': ('apg::__sixteen%d' % self.dwidth)}[base]
+            return base if (off in ['', '0']) else ('%s + %d' % (base, int(off) / 4))
+
+        narrow = (args[-1].startswith('%%xmm') or args[0].startswith('%%xmm'))
+        x = [operand(a) for a in args]
+
+        def lo(v):
+            return '_mm256_castsi256_si128(%s)' % v
+
+        def zext(v):
+            return '_mm256_inserti128_si256(_mm256_setzero_si256(), %s, 0)' % v
+
+        if (op in ['mov', 'kmovw', 'vmovdqa64']):
+            return '%s = %s;' % (x[1], x[0])
+        if (op in ['vmovdqu', 'vmovdqu32']):
+            if args[0].startswith('%%'):
+                if narrow:
+                    return '_mm_storeu_si128((__m128i*) (%s), %s);' % (x[1], lo(x[0]))
+                if masked:
+                    return '%smask_storeu_epi32(%s, %s, %s);' % (mm, x[1], mask, x[0])
+                return '%sstoreu_si%d((__m%di*) (%s), %s);' % (mm, w, w, x[1], x[0])
+            if narrow:
+                return '%s = %s;' % (x[1], zext('_mm_loadu_si128((const __m128i*) (%s))' % x[0]))
+            if masked and zeroing:
+                return '%s = %smaskz_loadu_epi32(%s, %s);' % (x[1], mm, mask, x[0])
+            return '%s = %sloadu_si%d((const __m%di*) (%s));' % (x[1], mm, w, w, x[0])
+        if (op == 'vpbroadcastd'):
+            return '%s = %sset1_epi32(*(%s));' % (x[1], mm, x[0])
+
+        if masked:
+            print("Error: cannot translate %s" % s)
+            exit(1)
+
+        bitwise = {'vpand': 'and', 'vpor': 'or', 'vpxor': 'xor', 'vpandn': 'andnot'}
+        if (op[:-1] in bitwise) and (op[-1] == 'd'):
+            op = op[:-1]
+        if (op in bitwise):
+            if narrow:
+                e = zext('_mm_%s_si128(%s, %s)' % (bitwise[op], lo(x[1]), lo(x[0])))
+            else:
+                e = '%s%s_si%d(%s, %s)' % (mm, bitwise[op], w, x[1], x[0])
+        elif (op in ['vpsrld', 'vpslld']):
+            if narrow:
+                e = zext('_mm_%si_epi32(%s, %s)' % (op[2:5], lo(x[1]), x[0]))
+            else:
+                e = '%s%si_epi32(%s, %s)' % (mm, op[2:5], x[1], x[0])
+        elif (op == 'vpblendd'):
+            e = '_mm256_blend_epi32(%s, %s, %s)' % (x[2], x[1], x[0])
+        elif (op == 'vpermd'):
+            e = '_mm256_permutevar8x32_epi32(%s, %s)' % (x[0], x[1])
+        elif (op == 'vpermq'):
+            e = '_mm256_permute4x64_epi64(%s, %s)' % (x[1], x[0])
+        elif (op == 'vpcmpeqb'):
+            e = '_mm256_cmpeq_epi8(%s, %s)' % (x[1], x[0])
+        elif (op == 'vpternlogd'):
+            e = '%sternarylogic_epi32(%s, %s, %s, %s)' % (mm, x[3], x[2], x[1], x[0])
+        elif (op == 'valignd'):
+            e = '%salignr_epi32(%s, %s, %s)' % (mm, x[2], x[1], x[0])
+        else:
+            print("Error: cannot translate %s" % s)
+            exit(1)
+
+        return '%s = %s;' % (x[-1], e)
 
     def printcomment(self, s):
 
@@ -21,6 +113,11 @@ class iwriter:
 
     def preparethings(self, dwidth, reg13=13, reg14=14):
 
+        if ('avx512' in self.iset):
+            # Row shifts use valignd, so only the column mask is needed:
+            self.printinstr('vpbroadcastd (%%2), %%%%zmm%d' % reg14)
+            return
+
         regname = '%%ymm' if ('avx2' in self.iset) else '%%xmm'
         r13 = regname + str(reg13)
         r14 = regname + str(reg14)
@@ -49,11 +146,18 @@ class iwriter:
 
         if regname is None:
             regname = '%%ymm' if ('avx2' in self.iset) else '%%xmm'
+            regname = '%%zmm' if ('avx512' in self.iset) else regname
         i1 = regname + str(inreg1)
         i2 = regname + str(inreg2)
         o1 = regname + str(outreg)
 
-        if 'avx' in self.iset:
+        if ('avx512' in self.iset) and (regname == '%%zmm'):
+            # EVEX-encoded bitwise operations need an element width:
+            if (op == 'pcmpeqb'):
+                self.printinstr('vpternlogd $0xff, %s, %s, %s' % (i1, i2, o1))
+            else:
+                self.printinstr('v%sd %s, %s, %s' % (op, i1, i2, o1))
+        elif 'avx' in self.iset:
             self.printinstr('v%s %s, %s, %s' % (op, i1, i2, o1))
         elif (i2 == o1):
             self.printinstr('%s %s, %s' % (op, i1, o1))
@@ -67,6 +171,45 @@ class iwriter:
             self.printinstr('movdqa %s, %s' % (i2, o1))
             self.printinstr('%s %s, %s' % (op, i1, o1))
 
+    def emitluts(self, luts):
+        '''
+        Emit a circuit of ternary lookup tables (in the format returned by
+        lutsearch) as vpternlogd instructions. These are destructive, so
+        each result overwrites a source which is no longer needed, or else
+        a copy of one; the final result ends up in zmm10.
+        '''
+
+        pool = lutregs + [0, 1, 13, 15]
+        where = dict(enumerate(lutregs))
+        lastuse = {}
+        for (n, (sources, table)) in enumerate(luts):
+            for x in sources:
+                lastuse[x] = n
+
+        for (n, (sources, table)) in enumerate(luts):
+            srcregs = [where[x] for x in sources]
+            if (n + 1 == len(luts)):
+                dst = 10
+            else:
+                dying = [where[x] for x in sources if (lastuse[x] == n)]
+                occupied = [where[x] for x in where if (lastuse.get(x, -1) >= n)]
+                dst = dying[0] if dying else [r for r in pool if r not in occupied][0]
+            if dst in srcregs:
+                k = srcregs.index(dst)
+            else:
+                k = 0
+                self.printinstr('vmovdqa64 %%%%zmm%d, %%%%zmm%d' % (srcregs[0], dst))
+            order = [k] + [j for j in xrange(3) if (j != k)]
+            imm = 0
+            for idx in xrange(8):
+                oidx = 0
+                for j in xrange(3):
+                    oidx |= ((idx >> (2 - j)) & 1) << (2 - order[j])
+                imm |= ((table >> oidx) & 1) << idx
+            self.printinstr('vpternlogd $0x%02x, %%%%zmm%d, %%%%zmm%d, %%%%zmm%d' % (imm,
+                            srcregs[order[2]], srcregs[order[1]], dst))
+            where[5 + n] = dst
+
     def ntinit(self):
         '''
         Prepare lookup tables, masks, et cetera:
@@ -121,6 +264,17 @@ class iwriter:
 
     def load_and_hshift(self, i, oddgen, terminal):
 
+        if ('avx512' in self.iset):
+            # The rows beyond the end of the tile are zeroed by the opmask:
+            inreg = '%%zmm' + str(5 - 3 * (i % 2))
+            d = '(%1)' if (oddgen) else '(%0)'
+            d = d if (i == 0) else (str(64 * i) + d)
+            mask = '%{%%k1%}%{z%}' if terminal else ''
+            self.printinstr('vmovdqu32 %s, %s%s' % (d, inreg, mask))
+            self.printinstr('vpsrld $1, %s, %%%%zmm%d' % (inreg, 6 - 3 * (i % 2)))
+            self.printinstr('vpslld $1, %s, %%%%zmm1' % inreg)
+            return
+
         regbytes = 32 if ('avx2' in self.iset) else 16
         regname = '%%ymm' if (('avx2' in self.iset) and not terminal) else '%%xmm'
         accessor = 'vmovdqu' if ('avx' in self.iset) else 'movups'
@@ -141,6 +295,16 @@ class iwriter:
 
     def horizontal_adders(self, i):
 
+        if ('avx512' in self.iset):
+            # Full adder as a pair of three-input lookup tables:
+            s = '%%zmm' + str(6 - 3 * (i % 2))
+            c = '%%zmm' + str(7 - 3 * (i % 2))
+            x = '%%zmm' + str(5 - 3 * (i % 2))
+            self.printinstr('vmovdqa64 %s, %s' % (s, c))
+            self.printinstr('vpternlogd $0x96, %s, %%%%zmm1, %s' % (x, s))
+            self.printinstr('vpternlogd $0xe8, %s, %%%%zmm1, %s' % (x, c))
+            return
+
         self.logicgate('pxor', 0, 1, 6 - 3 * (i % 2))
         self.logicgate('pand', 0, 1, 7 - 3 * (i % 2))
         self.logicgate('pand', 5 - 3 * (i % 2), 6 - 3 * (i % 2), 1)
@@ -149,7 +313,16 @@ class iwriter:
 
     def vertical_bitshifts(self, i):
 
-        if 'avx2' in self.iset:
+        if 'avx512' in self.iset:
+            # Concatenate the previous and current blocks of 16 rows:
+            p = 3 + 3 * (i % 2)
+            c = 6 - 3 * (i % 2)
+            self.printinstr('valignd $1, %%%%zmm%d, %%%%zmm%d, %%%%zmm8' % (p, c))
+            self.printinstr('valignd $1, %%%%zmm%d, %%%%zmm%d, %%%%zmm9' % (p + 1, c + 1))
+            self.printinstr('valignd $2, %%%%zmm%d, %%%%zmm%d, %%%%zmm10' % (p, c))
+            self.printinstr('valignd $2, %%%%zmm%d, %%%%zmm%d, %%%%zmm11' % (p + 1, c + 1))
+            self.printinstr('valignd $1, %%%%zmm%d, %%%%zmm%d, %%%%zmm12' % (p - 1, c - 1))
+        elif 'avx2' in self.iset:
             self.logicgate('pblendd $1,', 6 - 3 * (i % 2), 3 + 3 * (i % 2), 8)
             self.logicgate('pblendd $1,', 7 - 3 * (i % 2), 4 + 3 * (i % 2), 9)
             self.logicgate('pblendd $3,', 6 - 3 * (i % 2), 3 + 3 * (i % 2), 10)
@@ -178,6 +351,13 @@ class iwriter:
 
     def vertical_adders(self, i):
 
+        if ('avx512' in self.iset):
+            for (a, b, c, t) in [(3 + 3 * (i % 2), 8, 10, 0), (4 + 3 * (i % 2), 9, 11, 1)]:
+                self.printinstr('vmovdqa64 %%%%zmm%d, %%%%zmm%d' % (b, t))
+                self.printinstr('vpternlogd $0xe8, %%%%zmm%d, %%%%zmm%d, %%%%zmm%d' % (a, c, b))
+                self.printinstr('vpternlogd $0x96, %%%%zmm%d, %%%%zmm%d, %%%%zmm%d' % (a, t, c))
+            return
+
         self.logicgate('pxor', 3 + 3 * (i % 2), 8, 8)
         self.logicgate('pxor', 4 + 3 * (i % 2), 9, 9)
         self.logicgate('pxor', 8, 10, 10)
@@ -218,17 +398,18 @@ class iwriter:
 
         ess[0] = (1 - ess[8]) if essxor else ess[8]
         usetopbit = (essxor or beexor)
+        gates = []
 
-        self.logicgate('pand', 8, 11, 1)
-        self.logicgate('pxor', 11, 8, 8)
+        gates.append(('pand', 8, 11, 1))
+        gates.append(('pxor', 11, 8, 8))
         if (beexor and not essxor):
-            self.logicgate('pand', 1, 9, 0)
-            self.logicgate('pandn', 0, 12, 11)
+            gates.append(('pand', 1, 9, 0))
+            gates.append(('pandn', 0, 12, 11))
         elif (usetopbit):
-            self.logicgate('pand', 1, 9, 11)
+            gates.append(('pand', 1, 9, 11))
         if (essxor and not beexor):
-            self.logicgate('pand', 12, 11, 11)
-        self.logicgate('pxor', 1, 9, 9)
+            gates.append(('pand', 12, 11, 11))
+        gates.append(('pxor', 1, 9, 9))
 
         ruleint = 0;
         for i in xrange(8):
@@ -306,27 +487,57 @@ class iwriter:
 
         if (rulestring == 'b3s23'):
             # Possibly more optimal due to instruction order:
-            self.logicgate('pxor', 9, 8, 8)
-            self.logicgate('por', 10, 12, 12)
-            self.logicgate('pxor', 9, 10, 10)
-            self.logicgate('pand', 12, 8, 8)
-            self.logicgate('pand', 8, 10, 10)
+            gates.append(('pxor', 9, 8, 8))
+            gates.append(('por', 10, 12, 12))
+            gates.append(('pxor', 9, 10, 10))
+            gates.append(('pand', 12, 8, 8))
+            gates.append(('pand', 8, 10, 10))
         else:
             for i in xrange(0, len(rchars), 4):
-                self.logicgate('p'+opnames[rchars[i+3]], regnames[rchars[i+1]], regnames[rchars[i+2]], regnames[rchars[i]])
+                gates.append(('p'+opnames[rchars[i+3]], regnames[rchars[i+1]], regnames[rchars[i+2]], regnames[rchars[i]]))
 
         if (usetopbit):
             # printcomment(g, 'correct for B8/S8 nonsense:')
-            self.logicgate('pxor', 11, 10, 10)
+            gates.append(('pxor', 11, 10, 10))
 
         if (negate):
             # Rule contains B0:
-            self.logicgate('pcmpeqb', 11, 11, 11)
-            self.logicgate('pxor', 11, 10, 10)
+            gates.append(('pcmpeqb', 11, 11, 11))
+            gates.append(('pxor', 11, 10, 10))
+
+        luts = None
+        if ('avx512' in self.iset):
+            table = gatetable(gates)
+            if table not in lutcache:
+                lutcache[table] = lutsearch(*table) or gatefuse(gates)
+            luts = lutcache[table]
+        self.gatecount = (len(gates), len(luts) if luts else len(gates))
+
+        if luts:
+            self.emitluts(luts)
+        else:
+            for (op, inreg1, inreg2, outreg) in gates:
+                self.logicgate(op, inreg1, inreg2, outreg)
 
 
     def save_result(self, i, oddgen, terminal, diff=False):
 
+        if ('avx512' in self.iset):
+            # Each block of differences is written back to e, to be
+            # inspected by the caller once the asm block has finished:
+            mask = '%{%%k2%}' if terminal else ''
+            e = '(%1)' if (i == 1) else (str(64 * (i - 1)) + '(%1)')
+            if oddgen:
+                d = str(64 * (i - 1) + 8) + '(%0)'
+                self.printinstr('vmovdqu32 %s, %%%%zmm8%s' % (d, (mask + '%{z%}') if terminal else ''))
+                self.printinstr('vpternlogd $0xe2, %%zmm8, %%zmm14, %%zmm10')
+                self.printinstr('vmovdqu32 %%%%zmm10, %s%s' % (d, mask))
+                self.logicgate('pxor', 8, 10, 8)
+                self.printinstr('vmovdqu32 %%%%zmm8, %s%s' % (e, mask))
+            else:
+                self.printinstr('vmovdqu32 %%%%zmm10, %s%s' % (e, mask))
+            return
+
         regbytes = 32 if ('avx2' in self.iset) else 16
         if oddgen:
             e = str(regbytes * (i - 1) + 8) + '(%0)'
@@ -358,24 +569,85 @@ class iwriter:
 
     def prologue(self):
 
-        self.f.write('        asm (\n')
+        if self.intrinsics:
+            w = 512 if ('avx512' in self.iset) else 256
+            regs = ', '.join([('%smm%d' % ('z' if (w == 512) else 'y', i)) for i in xrange(16)])
+            self.f.write('        {\n')
+            self.f.write('        __m%di __attribute__((unused)) %s;\n' % (w, regs))
+            if (w == 512):
+                self.f.write('        uint32_t __attribute__((unused)) ebx;\n')
+                self.f.write('        __mmask16 __attribute__((unused)) k1, k2;\n')
+        else:
+            self.f.write('        asm (\n')
 
     def epilogue(self, dwidth):
 
+        if self.intrinsics:
+            self.f.write('        }\n\n')
+            return
+
         self.f.write('                : /* no output operands */ \n')
         self.f.write('                : "r" (d), "r" (e)')
         if (dwidth):
             self.f.write(', "r" (apg::__sixteen%d)' % dwidth)
         self.f.write('\n')
         self.f.write('                : "ebx", ')
+        if ('avx512' in self.iset):
+            self.f.write('"k1", "k2", ')
         for i in xrange(16):
             self.f.write('"xmm%d", ' % i)
             if (i % 6 == 4):
                 self.f.write('\n' + (' ' * 20))
         self.f.write('"memory");\n\n')
 
+    def logicfile(self, rulestring):
+
+        if self.intrinsics:
+            return '#include "li_%s_%s.h"\n' % (self.besti, rulestring)
+        else:
+            return '#include "ll_%s_%s.asm"\n' % (self.besti, rulestring)
+
+    def opmask(self, k, rows):
+
+        self.printinstr('mov $0x%x, %%%%ebx' % ((1 << rows) - 1))
+        self.printinstr('kmovw %%%%ebx, %%%%k%d' % k)
+
+    def assemble512(self, rulestring, oddgen, rowcount, dwidth):
+        '''
+        A zmm register holds 16 rows, so a tile is read in (at most) two
+        loads; ragged ends are handled by opmasks k1 (loads) and k2 (stores)
+        rather than by dropping to narrower registers.
+        '''
+
+        self.prologue()
+        self.preparethings(dwidth)
+
+        limit = rowcount - (4 if oddgen else 0)
+        iters = (limit + 15) / 16 + 1
+        if (rowcount % 16):
+            self.opmask(1, rowcount % 16)
+        if (limit % 16):
+            self.opmask(2, limit % 16)
+
+        for i in xrange(iters):
+            if (i * 16 < rowcount):
+                self.load_and_hshift(i, oddgen, ((i + 1) * 16 > rowcount))
+                self.horizontal_adders(i)
+            if (i > 0):
+                self.vertical_bitshifts(i)
+                self.vertical_adders(i)
+                self.f.write(self.logicfile(rulestring))
+                self.save_result(i, oddgen, (i * 16 > limit))
+
+        self.epilogue(dwidth)
+
     def assemble(self, rulestring, oddgen, rowcount, dwidth):
 
+        self.dwidth = dwidth
+        if ('avx512' in self.iset):
+            self.assemble512(rulestring, oddgen, rowcount, dwidth)
+            return
+
         self.prologue()
         self.preparethings(dwidth)
 
@@ -394,7 +666,7 @@ class iwriter:
             if (i > 0):
                 self.vertical_bitshifts(i)
                 self.vertical_adders(i)
-                self.f.write('#include "ll_%s_%s.asm"\n' % (self.besti, rulestring))
+                self.f.write(self.logicfile(rulestring))
                 terminal = (i * rpr == rowcount + (0 if oddgen else 4))
                 if oddgen:
                     if (i == 1):
@@ -409,11 +681,18 @@ class iwriter:
 
         self.epilogue(dwidth)
 
+    def attributes(self):
+
+        # Intrinsics need the compiler to target the instruction set:
+        if self.intrinsics and ('avx512' not in self.iset):
+            return '__attribute__((target("%s"))) ' % self.besti
+        return ''
+
     def gwrite_function(self, rulestring, rowcount, dwidth):
 
         name = 'iterate_%s_%d_%d' % (self.besti, rowcount, dwidth)
         params = 'uint32_t * __restrict__ d, uint32_t * __restrict__ e, uint32_t * __restrict__ h, uint32_t * __restrict__ j'
-        self.f.write('    void %s(%s) {\n' % (name, params))
+        self.f.write('    %svoid %s(%s) {\n' % (self.attributes(), name, params))
         logstring = rulestring[rulestring.index('b'):]
         self.assemble(logstring, 0, rowcount, dwidth)
         self.f.write('            for (int i = 1; i < %d; i++) {\n' % (rowcount - 1))
@@ -432,7 +711,7 @@ class iwriter:
         for i in 'jhed':
             params = 'uint32_t * __restrict__ ' + i + ', ' + params
 
-        self.f.write('    bool %s(%s) {\n' % (name, params))
+        self.f.write('    %sbool %s(%s) {\n' % (self.attributes(), name, params))
 
         self.f.write('        if (h) {\n')
         self.f.write('            for (int i = 0; i < %d; i++) {\n' % (rowcount))
@@ -486,7 +765,17 @@ class iwriter:
         self.f.write('            }\n')
         self.f.write('        }\n')
 
-        if 'avx2' in self.iset:
+        if 'avx512' in self.iset:
+            self.f.write('        uint32_t bigdiff = 0;\n')
+            self.f.write('        for (int i = 0; i < %d; i++) {\n' % (rowcount - 4))
+            self.f.write('            bigdiff |= e[i];\n')
+            self.f.write('        }\n')
+            self.f.write('        if (diffs != 0) {\n')
+            self.f.write('        diffs[0] = bigdiff;\n')
+            self.f.write('        diffs[1] = e[0] | e[1];\n')
+            self.f.write('        diffs[2] = e[%d] | e[%d];\n' % (rowcount - 6, rowcount - 5))
+            self.f.write('        }\n')
+        elif 'avx2' in self.iset:
             self.f.write('        uint32_t bigdiff = e[8] | e[9] | e[10] | e[11] | e[12] | e[13] | e[14] | e[15];\n')
             self.f.write('        if (diffs != 0) {\n')
             self.f.write('        diffs[0] = bigdiff;\n')
@@ -545,23 +834,269 @@ class iwriter:
         self.f.write('        return 0;\n')
         self.f.write('    }\n\n')
 
-    def __init__(self, f, iset):
+    def __init__(self, f, iset, intrinsics=False):
         self.f = f
         self.iset = iset
-        for k in ['sse2', 'sse3', 'ssse3', 'sse4', 'avx', 'avx2']:
+        self.intrinsics = intrinsics
+        self.dwidth = 0
+        for k in ['sse2', 'sse3', 'ssse3', 'sse4', 'avx', 'avx2', 'avx512']:
             if k in iset:
                 self.besti = k
 
-def gwli_bsi(f, bsi, msi):
+# The rule logic is a function of five bitplanes: the three bits of the
+# neighbourhood count (weights 1, 2, 2, 4) left by the vertical adders,
+# and the centre cell. Inputs 0--4 live in these registers:
+lutregs = [10, 8, 11, 9, 12]
+lutfull = 0xffffffff
+lutcache = {}
+lutvars = [sum([(1 << i) for i in xrange(32) if ((i >> v) & 1)]) for v in xrange(5)]
+
+def gateeval(gates, regs):
+    '''
+    Evaluate a sequence of two-input gates on truth tables, updating the
+    dictionary of register contents.
+    '''
+
+    for (op, inreg1, inreg2, outreg) in gates:
+        a = regs[inreg1]
+        b = regs[inreg2]
+        if (op == 'pand'):
+            regs[outreg] = a & b
+        elif (op == 'por'):
+            regs[outreg] = a | b
+        elif (op == 'pxor'):
+            regs[outreg] = a ^ b
+        elif (op == 'pandn'):
+            regs[outreg] = a & (lutfull ^ b)
+        elif (op == 'pcmpeqb') and (inreg1 == inreg2):
+            regs[outreg] = lutfull
+        else:
+            print("Error: cannot evaluate %s" % op)
+            exit(1)
+
+def gatetable(gates):
+    '''
+    Truth table of the result (register 10) of a sequence of two-input gates
+    over all 32 combinations of the five inputs, together with the mask of
+    combinations which can actually occur.
+    '''
+
+    regs = dict(zip(lutregs, lutvars))
+    gateeval(gates, regs)
+
+    # A count of zero with a live centre, or a count of nine with a dead
+    # centre, cannot occur:
+    care = lutfull ^ (1 << 16) ^ (1 << 15)
+    return (regs[10] & care, care)
+
+def lutapply(table, ins):
+    '''
+    Truth table of a lookup table applied to the truth tables in ins (the
+    first being the most significant, as in vpternlogd).
+    '''
+
+    r = 0
+    for idx in xrange(1 << len(ins)):
+        if ((table >> idx) & 1):
+            t = lutfull
+            for (k, x) in enumerate(ins):
+                t &= x if ((idx >> (len(ins) - 1 - k)) & 1) else (lutfull ^ x)
+            r |= t
+    return r
+
+def lutgroups(ins):
+
+    return [lutapply(1 << idx, ins) for idx in xrange(1 << len(ins))]
+
+def lutfit(f1, f0, ins):
+    '''
+    Return a lookup table g such that g(ins) is 1 on the rows f1 and 0 on
+    the rows f0, or None if there is no such table.
+    '''
+
+    table = 0
+    for (idx, g) in enumerate(lutgroups(ins)):
+        if (g & f1):
+            if (g & f0):
+                return None
+            table |= (1 << idx)
+    return table
+
+def lutsplit(f1, f0, patterns, groups):
+    '''
+    Look for a union y of patterns such that, within each group, the rule
+    is a function of y. This is a two-colouring problem with parity
+    constraints, solved with a small union-find.
+    '''
+
+    parent = range(len(patterns))
+    parity = [0] * len(patterns)
+
+    def find(x):
+        p = 0
+        while (parent[x] != x):
+            p ^= parity[x]
+            x = parent[x]
+        return (x, p)
+
+    def join(x, y, d):
+        (rx, px) = find(x)
+        (ry, py) = find(y)
+        if (rx == ry):
+            return ((px ^ py) == d)
+        parent[rx] = ry
+        parity[rx] = px ^ py ^ d
+        return True
+
+    for g in groups:
+        g1 = g & f1
+        g0 = g & f0
+        if not (g1 and g0):
+            continue
+        ones = [i for (i, p) in enumerate(patterns) if (p & g1)]
+        zeros = [i for (i, p) in enumerate(patterns) if (p & g0)]
+        for i in ones[1:]:
+            if not join(ones[0], i, 0):
+                return None
+        for i in zeros:
+            if not join(ones[0], i, 1):
+                return None
+
+    y = 0
+    for (i, p) in enumerate(patterns):
+        if find(i)[1]:
+            y |= p
+    return y
+
+def lutsearch(f, care):
+    '''
+    Exhaustively search for a circuit of at most three ternary lookup tables
+    (vpternlogd) computing the rule. Returns a list of (sources, table)
+    pairs, where the sources index the five inputs followed by the outputs
+    of earlier tables, or None if no such circuit exists.
+    '''
+
+    f1 = f & care
+    f0 = (lutfull ^ f) & care
+    xs = lutvars
+    triples = [(a, b, c) for a in xrange(5) for b in xrange(a+1, 5) for c in xrange(b+1, 5)]
+    pairs = [(a, b) for a in xrange(5) for b in xrange(a+1, 5)]
+
+    # One lookup table:
+    for t in triples:
+        table = lutfit(f1, f0, [xs[v] for v in t])
+        if table is not None:
+            return [(t, table)]
+
+    # Every nontrivial function of three inputs, up to complementation:
+    firsts = {}
+    for t in triples:
+        for table in xrange(1, 128):
+            x = lutapply(table, [xs[v] for v in t])
+            if (x not in firsts) and ((lutfull ^ x) not in firsts):
+                firsts[x] = (t, table)
+    firsts = sorted(firsts.items())
+
+    # Two lookup tables, as g(h(...), a, b):
+    for (x, (t, table)) in firsts:
+        for (a, b) in pairs:
+            table2 = lutfit(f1, f0, [x, xs[a], xs[b]])
+            if table2 is not None:
+                return [(t, table), ((5, a, b), table2)]
+
+    # Only groups containing both values of the rule constrain a split:
+    pairgroups = [[g for g in lutgroups([xs[c], xs[d]]) if (g & f1) and (g & f0)] for (c, d) in pairs]
+    triplegroups = [lutgroups([xs[v] for v in u]) for u in triples]
+
+    # Three lookup tables, as g(h(k(...), a, b), c, d):
+    for (x, (t, table)) in firsts:
+        for (a, b) in pairs:
+            patterns = lutgroups([x, xs[a], xs[b]])
+            for (j, (c, d)) in enumerate(pairs):
+                y = lutsplit(f1, f0, patterns, pairgroups[j])
+                if y is not None:
+                    table2 = lutfit(y, lutfull ^ y, [x, xs[a], xs[b]])
+                    table3 = lutfit(f1, f0, [y, xs[c], xs[d]])
+                    return [(t, table), ((5, a, b), table2), ((6, c, d), table3)]
+
+    # Three lookup tables, as g(k(...), h(...), a):
+    for (x, (t, table)) in firsts:
+        for a in xrange(5):
+            groups = [g for g in lutgroups([x, xs[a]]) if (g & f1) and (g & f0)]
+            for (j, u) in enumerate(triples):
+                y = lutsplit(f1, f0, triplegroups[j], groups)
+                if y is not None:
+                    table2 = lutfit(y, lutfull ^ y, [xs[v] for v in u])
+                    table3 = lutfit(f1, f0, [x, y, xs[a]])
+                    return [(t, table), (u, table2), ((5, 6, a), table3)]
+
+    return None
+
+def gatefuse(gates):
+    '''
+    Fallback for rules without a circuit of three lookup tables: absorb each
+    two-input gate into its only consumer whenever the result still has at
+    most three inputs. Returns a circuit in the same format as lutsearch.
+    '''
+
+    funcs = list(lutvars)
+    srcs = [[] for v in lutvars]
+    signal = dict(zip(lutregs, xrange(5)))
+    regs = dict(zip(lutregs, lutvars))
+    for (op, inreg1, inreg2, outreg) in gates:
+        if (op == 'pcmpeqb'):
+            srcs.append([])
+        else:
+            srcs.append(sorted(set([signal[inreg1], signal[inreg2]])))
+        gateeval([(op, inreg1, inreg2, outreg)], regs)
+        funcs.append(regs[outreg])
+        signal[outreg] = len(funcs) - 1
+
+    output = signal[10]
+    changed = True
+    while changed:
+        changed = False
+        live = [output]
+        for x in live:
+            live += [y for y in srcs[x] if (y >= 5) and (y not in live)]
+        users = [0] * len(funcs)
+        for x in live:
+            for y in srcs[x]:
+                users[y] += 1
+        for x in sorted(live, reverse=True):
+            for y in srcs[x]:
+                merged = sorted(set(srcs[x] + srcs[y]) - set([y]))
+                if (y >= 5) and (users[y] == 1) and (len(merged) <= 3):
+                    srcs[x] = merged
+                    changed = True
+                    break
+            if changed:
+                break
+
+    live = sorted(live)
+    renumber = dict([(x, 5 + i) for (i, x) in enumerate(live)] + [(v, v) for v in xrange(5)])
+    luts = []
+    for x in live:
+        sources = ((srcs[x] or [0]) * 3)[:3]
+        table = lutfit(funcs[x], lutfull ^ funcs[x], [funcs[y] for y in sources])
+        luts.append((tuple([renumber[y] for y in sources]), table))
+    return luts
+
+# Instruction sets for which kernels are generated:
+isets = [['sse2'], ['sse2', 'avx'], ['sse2', 'avx', 'avx2'], ['sse2', 'avx', 'avx2', 'avx512']]
 
+def gwli_bsi(f, bsi, msi, isi=None):
+
+    isi = bsi if (isi is None) else isi
     f.write('            apg::z64_to_r32_%s(inleaves, d);\n' % bsi)
     f.write('            apg::z64_to_r32_%s(hleaves, h);\n' % bsi)
-    f.write('            iterate_var_%s(d, h);\n' % bsi)
+    f.write('            iterate_var_%s(d, h);\n' % isi)
     f.write('            apg::r32_centre_to_z64_%s(d, outleaf);\n' % msi)
     f.write('            apg::r32_centre_to_z64_%s(h, outleaf2);\n' % msi)
 
-def wli_bsi(f, hist, bsi, msi):
+def wli_bsi(f, hist, bsi, msi, isi=None):
 
+    isi = bsi if (isi is None) else isi
     f.write('            apg::z64_to_r32_%s(inleaves, d);\n' % bsi)
     if (hist >= 2):
         f.write('            apg::z64_to_r32_%s(jleaves, j);\n' % bsi)
@@ -569,11 +1104,11 @@ def wli_bsi(f, hist, bsi, msi):
         f.write('            apg::z64_to_r32_%s(hleaves, h);\n' % bsi)
 
     if (hist >= 2):
-        f.write('            nochange = (iterate_var_%s(n, d, h, j) == n);\n' % bsi)
+        f.write('            nochange = (iterate_var_%s(n, d, h, j) == n);\n' % isi)
     elif (hist >= 1):
-        f.write('            nochange = (iterate_var_%s(n, d, h) == n);\n' % bsi)
+        f.write('            nochange = (iterate_var_%s(n, d, h) == n);\n' % isi)
     else:
-        f.write('            nochange = (iterate_var_%s(n, d) == n);\n' % bsi)
+        f.write('            nochange = (iterate_var_%s(n, d) == n);\n' % isi)
 
     f.write('            apg::r32_centre_to_z64_%s(d, outleaf);\n' % msi)
     if (hist >= 2):
@@ -608,26 +1143,21 @@ def write_all_iterators(f, hist, rules):
     f.write('    int iterate_var_leaf(int rule, %s) {\n' % params)
     f.write('        switch(rule) {\n')
 
-    not_used = True
     for (i, runsafe) in enumerate(rules):
         r = runsafe.replace('-', '_')
         m = re.match('b0?1?2?3?4?5?6?7?8?s0?1?2?3?4?5?6?7?8?$', runsafe)
         if m is not None:
-            not_used = False
             f.write('            case %d :\n' % i)
             f.write('                return %s::iterate_var_leaf(%s);\n' % (r, xparams))
         elif ((r[0] == 'g') and (hist == 1)):
-            not_used = False
             f.write('            case %d :\n' % i)
             f.write('                return %s::iterate_var_leaf(inleaves, hleaves, outleaf);\n' % r)
         elif ((r[0] != 'g') and (hist == 0)):
-            not_used = False
             f.write('            case %d :\n' % i)
             f.write('                return %s::iterate_var_leaf(inleaves, outleaf);\n' % r)
     f.write('        }\n')
-    if not_used:
-        f.write('        (void) %s;\n' % (xparams.replace(',', '; (void)')))
-    f.write('        return -1;\n')
+    f.write('        return jit::iterate_var_leaf(rule, n, inleaves, %s, %s, outleaf);\n' % (
+            'hleaves' if hist else '0', 'jleaves' if (hist >= 2) else '0'))
     f.write('    }\n\n')
 
     f.write('    int iterate_var_32_28(int rule, %s) {\n' % params2)
@@ -642,6 +1172,11 @@ def write_all_iterators(f, hist, rules):
         if m is not None:
             not_used = False
             f.write('            case %d :\n' % i)
+            f.write('#ifdef __AVX512F__\n')
+            f.write('                if (bis >= 11) {\n')
+            f.write('                    return %s::iterate_avx512_32_28(%s);\n' % (r, xparams2))
+            f.write('                } else\n')
+            f.write('#endif\n')
             f.write('                if (bis >= 10) {\n')
             f.write('                    return %s::iterate_avx2_32_28(%s);\n' % (r, xparams2))
             f.write('                } else if (bis >= 9) {\n')
@@ -651,9 +1186,9 @@ def write_all_iterators(f, hist, rules):
             f.write('                }\n')
     f.write('        }\n')
     if not_used:
-        f.write('        (void) %s;\n' % (xparams2.replace(', 0', '').replace(', false', '').replace(',', '; (void)')))
-        f.write('        (void) bis;\n')
-    f.write('        return -1;\n')
+        f.write('        (void) e; (void) bis;\n')
+    f.write('        return jit::iterate_var_32_28(rule, d, %s, %s, diffs);\n' % (
+            'h' if hist else '0', 'j' if (hist >= 2) else '0'))
     f.write('    }\n\n')
 
 def write_leaf_iterator(f, hist):
@@ -675,6 +1210,11 @@ def write_leaf_iterator(f, hist):
     if (hist >= 2):
         f.write('        uint32_t j[32];\n')
 
+    f.write('#ifdef __AVX512F__\n')
+    f.write('        if (bis >= 11) {\n')
+    wli_bsi(f, hist, 'avx2', 'avx2', 'avx512')
+    f.write('        } else\n')
+    f.write('#endif\n')
     f.write('        if (bis >= 10) {\n')
     wli_bsi(f, hist, 'avx2', 'avx2')
     f.write('        } else if (bis >= 9) {\n')
@@ -696,6 +1236,11 @@ def gwrite_leaf_iterator(f, nstates):
     f.write('        int bis = apg::best_instruction_set();\n')
     f.write('        uint32_t d[32];\n')
     f.write('        uint32_t h[32];\n')
+    f.write('#ifdef __AVX512F__\n')
+    f.write('        if (bis >= 11) {\n')
+    gwli_bsi(f, 'avx2', 'avx2', 'avx512')
+    f.write('        } else\n')
+    f.write('#endif\n')
     f.write('        if (bis >= 10) {\n')
     gwli_bsi(f, 'avx2', 'avx2')
     f.write('        } else if (bis >= 9) {\n')
@@ -727,6 +1272,8 @@ def gwrite_leaf_iterator(f, nstates):
     f.write('        return false;\n')
     f.write('    }\n\n')
 
+gatecounts = {}
+
 def makeltl(rulestring, gparams):
 
     if not os.path.exists('lifelogic'):
@@ -778,10 +1325,16 @@ def makeasm(rulestring):
         os.makedirs('lifelogic')
 
     logstring = rulestring[rulestring.index('b'):]
-    for iset in [['sse2'], ['sse2', 'avx'], ['sse2', 'avx', 'avx2']]:
+    for iset in isets:
         with open('lifelogic/ll_%s_%s.asm' % (iset[-1], logstring), 'w') as f:
             ix = iwriter(f, iset)
             ix.genlogic(logstring)
+        if ('avx2' in iset):
+            with open('lifelogic/li_%s_%s.h' % (iset[-1], logstring), 'w') as f:
+                iwriter(f, iset, True).genlogic(logstring)
+
+    gatecounts[rulestring] = ix.gatecount
+    print("Gate count:       %d two-input, %d ternary" % ix.gatecount)
 
     with open('lifelogic/iterators_%s.h' % rulestring, 'w') as f:
         f.write('#pragma once\n')
@@ -789,6 +1342,7 @@ def makeasm(rulestring):
         f.write('#include "../lifeconsts.h"\n')
         f.write('#include "../lifeperm.h"\n')
         f.write('#include "../eors.h"\n')
+        f.write('#include <immintrin.h>\n')
         f.write('namespace %s {\n\n' % rulestring.replace('-', '_'))
 
         '''
@@ -799,17 +1353,46 @@ def makeasm(rulestring):
             f.write('1, 2, 3, 4, 5, 6, 7, 0};\n\n')
         '''
 
-        for iset in [['sse2'], ['sse2', 'avx'], ['sse2', 'avx', 'avx2']]:
-            iw = iwriter(f, iset)
-            if (rulestring[0] == 'g'):
-                iw.gwrite_function(rulestring, 20, 16)
-                iw.gwrite_iterator()
-            else:
-                iw.write_function(rulestring, 32, 28)
-                iw.write_function(rulestring, 28, 24)
-                iw.write_function(rulestring, 24, 20)
-                iw.write_function(rulestring, 20, 16)
-                iw.write_iterator()
+        # The AVX2 and AVX-512 kernels exist both as inline assembly and
+        # as intrinsics; USE_INTRINSICS selects which are used:
+        for (ns, intrinsics) in [(None, False), ('inlineasm', False), ('intrinsics', True)]:
+            if intrinsics:
+                # GCC 12 warns spuriously about _mm512_undefined_epi32() in
+                # the headers for the immediate shift and align intrinsics:
+                f.write('#pragma GCC diagnostic push\n')
+                f.write('#pragma GCC diagnostic ignored "-Wuninitialized"\n')
+                f.write('#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"\n')
+            if ns is not None:
+                f.write('    namespace %s {\n\n' % ns)
+            for iset in isets:
+                if (ns is None) == ('avx2' in iset):
+                    continue
+                iw = iwriter(f, iset, intrinsics)
+                if ('avx512' in iset):
+                    # The opmask registers cannot be named in an asm clobber
+                    # list unless the compiler itself is targeting AVX-512:
+                    f.write('#ifdef __AVX512F__\n')
+                if (rulestring[0] == 'g'):
+                    iw.gwrite_function(rulestring, 20, 16)
+                    iw.gwrite_iterator()
+                else:
+                    iw.write_function(rulestring, 32, 28)
+                    iw.write_function(rulestring, 28, 24)
+                    iw.write_function(rulestring, 24, 20)
+                    iw.write_function(rulestring, 20, 16)
+                    iw.write_iterator()
+                if ('avx512' in iset):
+                    f.write('#endif\n\n')
+            if ns is not None:
+                f.write('    }\n\n')
+            if intrinsics:
+                f.write('#pragma GCC diagnostic pop\n\n')
+
+        f.write('#ifdef USE_INTRINSICS\n')
+        f.write('    using namespace intrinsics;\n')
+        f.write('#else\n')
+        f.write('    using namespace inlineasm;\n')
+        f.write('#endif\n\n')
 
         if (rulestring[0] == 'g'):
             gwrite_leaf_iterator(f, int(rulestring[1:rulestring.index('b')]))
@@ -896,11 +1479,13 @@ def main():
         f.write('#include <string>\n')
         for rulestring in rules:
             f.write('#include "iterators_%s.h"\n' % rulestring)
+        f.write('#include "../jitlife.h"\n')
         f.write('namespace apg {\n\n')
         f.write('    int rule2int(std::string rule) {\n')
         for (i, r) in enumerate(rules):
             f.write('        if (rule == "%s") { return %d; }\n' % (r, i))
-        f.write('        return -1;\n')
+        f.write('        // Other life-like rules are compiled at runtime:\n')
+        f.write('        return jit::rule2int(rule, %d);\n' % len(rules))
         f.write('    }\n\n')
         for hist in xrange(3):
             write_all_iterators(f, hist, rules)
@@ -908,7 +1493,7 @@ def main():
         f.write('    int uli_get_family(int rule) {\n')
         f.write('        switch (rule) {\n')
         for (i, r) in enumerate(rules):
-            m = re.match('b0?1?2?3?4?5?6?7?8?s0?1?2?3?4?5?6?7?8?$', rulestring)
+            m = re.match('b0?1?2?3?4?5?6?7?8?s0?1?2?3?4?5?6?7?8?$', r)
             f.write('            case %d :\n' % i)
             if m is not None:
                 f.write('                return 0;\n')
@@ -923,7 +1508,7 @@ def main():
         f.write('    uint64_t uli_valid_mantissa(int rule) {\n')
         f.write('        switch (rule) {\n')
         for (i, r) in enumerate(rules):
-            m = re.match('b0?1?2?3?4?5?6?7?8?s0?1?2?3?4?5?6?7?8?$', rulestring)
+            m = re.match('b0?1?2?3?4?5?6?7?8?s0?1?2?3?4?5?6?7?8?$', r)
             f.write('            case %d :\n' % i)
             if m is None:
                 f.write('                return 3;\n')
@@ -932,8 +1517,14 @@ def main():
             else:
                 f.write('                return 255;\n')
         f.write('        }\n')
-        f.write('        return 3;\n')
+        f.write('        return jit::uli_valid_mantissa(rule);\n')
         f.write('    }\n\n')
         f.write('}\n')
 
+    if gatecounts:
+        print("Logic gates per rule (two-input / ternary):")
+        for rulestring in rules:
+            if rulestring in gatecounts:
+                print("    %-20s %3d / %d" % ((rulestring,) + gatecounts[rulestring]))
+
 main()
@@ -0,0 +1,62 @@
+/*
+* Checks the JIT kernels against those produced by rule2asm.py. Run
+* 'python rule2asm.py b3s23 b36s23 b01356s012357' (any B/S rules will
+* do, at most four of them) and then:
+*
+* g++ -O3 -march=native --std=c++11 test_jitlife.cpp -o test_jitlife
+* ./test_jitlife b3s23 b36s23 b01356s012357
+*/
+
+#include "lifelogic/iterators_all.h"
+#include <iostream>
+#include <random>
+
+int main(int argc, char *argv[]) {
+
+    std::mt19937 rng(1);
+    int failures = 0;
+
+    for (int rule = 0; rule < argc - 1; rule++) {
+
+        uint32_t aot_d[32], aot_h[32], aot_j[32], aot_diffs[3];
+        uint32_t jit_d[32], jit_h[32], jit_j[32], jit_diffs[3];
+        uint64_t aot_in[16], aot_out[12], jit_out[12];
+
+        // The same rule again, compiled at runtime:
+        std::string rulestring = argv[rule + 1];
+        int jitrule = apg::jit::rule2int(rulestring, argc - 1);
+        if (jitrule < 0) {
+            std::cout << "JIT unavailable for " << rulestring << std::endl;
+            return 1;
+        }
+
+        for (int t = 0; t < 20000; t++) {
+
+            for (int i = 0; i < 32; i++) {
+                aot_d[i] = jit_d[i] = rng() & rng();
+                aot_h[i] = jit_h[i] = rng() & rng();
+                aot_j[i] = jit_j[i] = rng() | rng();
+            }
+
+            int a = apg::iterate_var_32_28(rule, aot_d, aot_h, aot_j, aot_diffs);
+            int b = apg::jit::iterate_var_32_28(jitrule, jit_d, jit_h, jit_j, jit_diffs);
+
+            bool same = (a == b) && (std::memcmp(aot_diffs, jit_diffs, sizeof(aot_diffs)) == 0);
+            same = same && (std::memcmp(aot_d, jit_d, sizeof(aot_d)) == 0);
+            same = same && (std::memcmp(aot_h, jit_h, sizeof(aot_h)) == 0);
+            same = same && (std::memcmp(aot_j, jit_j, sizeof(aot_j)) == 0);
+
+            for (int i = 0; i < 16; i++) { aot_in[i] = ((uint64_t) rng() << 32) | rng(); }
+            int n = 1 + (t & 7);
+            a = apg::iterate_var_leaf(rule, n, aot_in, aot_in, aot_in, aot_out);
+            b = apg::jit::iterate_var_leaf(jitrule, n, aot_in, aot_in, aot_in, jit_out);
+            same = same && (a == b) && (std::memcmp(aot_out, jit_out, sizeof(aot_out)) == 0);
+
+            if (!same) { failures += 1; }
+        }
+
+        std::cout << rulestring << ": " << (failures ? "FAILED" : "ok") << std::endl;
+    }
+
+    return (failures != 0);
+}
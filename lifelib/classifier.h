@@ -1,5 +1,8 @@
 #pragma once
 #include "pattern2.h"
+#include "apgcodes.h"
+#include "objectcache.h"
+#include "densebitworld.h"
 #include <unordered_map>
 #include <set>
 
@@ -21,8 +24,9 @@ namespace apg {
         std::string zoi;
         lifetree_abstract<uint32_t>* lab;
         lifetree<uint32_t, M + 1> lh;
-        std::unordered_map<uint64_t, std::string> bitcache;
-        std::unordered_map<std::string, std::vector<std::string> > decompositions;
+        // Objects already separated, perhaps shared with other classifiers:
+        object_cache owncache;
+        object_cache* cache;
 
         bool diagbirth() {
             /*
@@ -54,10 +58,9 @@ namespace apg {
             apg::pattern clunion(lab, lab->demorton(lrem, 1), rule);
 
             std::vector<pattern> clusters;
-            while (lrem.population() != 0) {
-                bitworld cluster = grow_cluster(lrem.get1cell(), env, "9");
-                lrem -= cluster;
-                apg::pattern ppart(lab, lab->demorton(cluster, 1), rule);
+            std::vector<bitworld> islands = find_clusters(lrem, env, "9", true);
+            for (uint64_t i = 0; i < islands.size(); i++) {
+                apg::pattern ppart(lab, lab->demorton(islands[i], 1), rule);
                 clusters.push_back(ppart & clunion);
             }
 
@@ -163,11 +166,10 @@ namespace apg {
 
             std::map<std::pair<int64_t, int64_t>, uint64_t> geography;
             uint64_t label = 0;
-            while (lrem.population() != 0) {
-                bitworld cluster = grow_cluster(lrem.get1cell(), env, reiterate ? "9" : zoi);
-                lrem -= cluster;
+            std::vector<bitworld> islands = find_clusters(lrem, env, reiterate ? "9" : zoi, true);
+            for (uint64_t k = 0; k < islands.size(); k++) {
                 label += 1;
-                std::vector<std::pair<int64_t, int64_t> > celllist = cluster.getcells();
+                std::vector<std::pair<int64_t, int64_t> > celllist = islands[k].getcells();
                 for (uint64_t i = 0; i < celllist.size(); i++) {
                     geography[celllist[i]] = label;
                 }
@@ -370,26 +372,27 @@ namespace apg {
 
         std::vector<bitworld> getclusters(bitworld &live, bitworld &env, bool rigorous) {
 
-            bitworld lrem = live;
-            std::vector<bitworld> clusters;
+            std::vector<bitworld> islands = find_clusters(live, env, zoi, false);
+            if (!rigorous) { return islands; }
 
-            while (lrem.population() != 0) {
-                // Obtain cluster:
-                bitworld cluster = grow_cluster(lrem.get1cell(), env, zoi);
-                cluster &= lrem;
-                lrem -= cluster;
-                if (rigorous) {
-                    pattern ppart(lab, lab->demorton(cluster, 1), rule);
-                    pseudoBangBang(ppart, &clusters);
-                } else {
-                    clusters.push_back(cluster);
-                }
+            std::vector<bitworld> clusters;
+            for (uint64_t i = 0; i < islands.size(); i++) {
+                pattern ppart(lab, lab->demorton(islands[i], 1), rule);
+                pseudoBangBang(ppart, &clusters);
             }
 
             return clusters;
         }
 
-        std::map<std::string, int64_t> census(std::vector<bitworld> &planes, std::string (*adv)(pattern)) {
+        std::vector<uint32_t> intern_all(const std::vector<std::string> &apgcodes_in) {
+            std::vector<uint32_t> ids;
+            for (uint64_t i = 0; i < apgcodes_in.size(); i++) {
+                ids.push_back(apgcodes.intern(apgcodes_in[i]));
+            }
+            return ids;
+        }
+
+        std::map<uint32_t, int64_t> census_ids(std::vector<bitworld> &planes, std::string (*adv)(pattern)) {
 
             bitworld lrem = planes[0];
             for (uint64_t i = 1; i < M; i++) {
@@ -398,30 +401,43 @@ namespace apg {
             bitworld env = lrem;
             env += planes[M];
 
-            std::map<std::string, int64_t> tally;
-            while (lrem.population() != 0) {
+            // Ash which fits in a modest box is separated into all of its
+            // clusters at once, in flat arrays rather than the tiles' tree:
+            std::vector<bitworld> clusters = find_clusters(lrem, env, zoi, false);
+
+            std::map<uint32_t, int64_t> tally;
+            for (uint64_t k = 0; k < clusters.size(); k++) {
 
                 // Obtain cluster:
-                bitworld cluster = grow_cluster(lrem.get1cell(), env, zoi);
-                cluster &= lrem;
-                lrem -= cluster;
+                bitworld cluster;
+                std::swap(cluster, clusters[k]);
                 uint64_t bb = 0;
+                tileset tiles;
+                bool tiled = false;
 
                 // Obtain representation (may be a pseudo-object):
-                std::string repr;
-                std::vector<std::string> elements;
+                uint32_t repr = 0;
+                std::vector<uint32_t> elements;
 
                 if (M == 1) {
                     if (cluster.world.size() > 1) { cluster = fix_topleft(cluster); }
                     if (cluster.world.size() == 1) {
                         // We use a bitcache for fast lookup of small objects:
                         auto it = cluster.world.begin(); bb = it->second;
+                    } else if (cluster.world.size() <= 16) {
+                        // ...and a tileset cache for those within 32x32:
+                        tiled = true; tiles.fill(0);
+                        for (auto it = cluster.world.begin(); it != cluster.world.end(); ++it) {
+                            int32_t x = it->first.first; int32_t y = it->first.second;
+                            if (it->second == 0) { continue; }
+                            if ((x < 0) || (y < 0) || (x >= 4) || (y >= 4)) { tiled = false; break; }
+                            tiles[x + 4 * y] = it->second;
+                        }
                     }
                 }
 
-                if ((bb != 0) && (bitcache.find(bb) != bitcache.end())) {
-                    repr = bitcache[bb];
-                    elements = decompositions[repr];
+                if (((bb != 0) && cache->find_bits(bb, repr)) || (tiled && cache->find_tiles(tiles, repr))) {
+                    cache->find_decomposition(repr, elements);
                 } else {
                     std::vector<bitworld> cplanes;
                     for (uint64_t i = 0; i < M; i++) {
@@ -431,14 +447,9 @@ namespace apg {
                     apg::pattern cl2(lab, cplanes, rule);
                     cl2.pdetect(1048576); // Restrict period.
                     if (cl2.dt != 0) {
-                        repr = cl2.apgcode();
-                        if (bb != 0) {
-                            bitcache.emplace(bb, repr);
-                            // std::cerr << "Bitstring " << bb << " = " << repr << std::endl;
-                        }
-                        auto it = decompositions.find(repr);
-                        if (it != decompositions.end()) {
-                            elements = it->second;
+                        repr = apgcodes.intern(cl2.apgcode());
+                        if (cache->find_decomposition(repr, elements)) {
+                            // Already separated (perhaps by another thread)
                         } else if ((M == 1) && (!b0)) {
                             // 2-state rule:
                             uint64_t period = cl2.ascertain_period();
@@ -446,19 +457,25 @@ namespace apg {
                                 // Separating standard spaceships is considerably
                                 // faster and more reliable with sss; only fall
                                 // back on pbb if this fails:
-                                elements = sss(cl2);
+                                elements = intern_all(sss(cl2));
                             }
-                            if (elements.size() == 0) { elements = pseudoBangBang(cl2, 0); }
-                            decompositions[repr] = elements;
+                            if (elements.size() == 0) { elements = intern_all(pseudoBangBang(cl2, 0)); }
+                            cache->insert_decomposition(repr, elements);
                         } else {
                             // PseudoBangBang not supported for multistate rules; skip separation:
                             elements.push_back(repr);
-                            decompositions[repr] = elements;
+                            cache->insert_decomposition(repr, elements);
+                        }
+                        // Only once the decomposition is in place, so that concurrent hits find it:
+                        if (bb != 0) {
+                            cache->insert_bits(bb, repr);
+                            // std::cerr << "Bitstring " << bb << " = " << repr << std::endl;
                         }
+                        if (tiled) { cache->insert_tiles(tiles, repr); }
                     } else {
                         std::string diagnosed = "PATHOLOGICAL";
                         if (adv != 0) { diagnosed = (*adv)(cl2); }
-                        elements.push_back(diagnosed);
+                        elements.push_back(apgcodes.intern(diagnosed));
                     }
                 }
 
@@ -470,6 +487,15 @@ namespace apg {
             return tally;
         }
 
+        std::map<std::string, int64_t> census(std::vector<bitworld> &planes, std::string (*adv)(pattern)) {
+            std::map<uint32_t, int64_t> tally = census_ids(planes, adv);
+            std::map<std::string, int64_t> named;
+            for (auto it = tally.begin(); it != tally.end(); ++it) {
+                named[apgcodes.apgcode(it->first)] += it->second;
+            }
+            return named;
+        }
+
         std::map<std::string, int64_t> census(bitworld &live, bitworld &env, std::string (*adv)(pattern)) {
             std::vector<bitworld> bwv;
             bwv.push_back(live); bwv.push_back(env);
@@ -493,10 +519,11 @@ namespace apg {
             return census(pat, numgens, 0);
         }
 
-        base_classifier(lifetree_abstract<uint32_t>* lab, std::string rule) : lh(100)
+        base_classifier(lifetree_abstract<uint32_t>* lab, std::string rule, object_cache* cache = 0) : lh(100)
         {
             this->lab = lab;
             this->rule = rule;
+            this->cache = (cache != 0) ? cache : &owncache;
 
             /*
             * We construct the transition table by bootstrapping: we run a
@@ -0,0 +1,299 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "bitworld.h"
+#include "spantree.h"
+
+namespace apg {
+
+    /*
+     * A bitworld confined to a bounding box, stored as a flat array of rows
+     * of 64-bit words (bit j of word i in row r is the cell (x0 + 64i + j,
+     * y0 + r)). Cells outside the box are always dead. The rows
+     * [top, bottom) bound the live cells, so that passes over a sparse box
+     * only touch the rows it occupies.
+     */
+    struct dense_bitworld {
+
+        int64_t x0;
+        int64_t y0;
+        int64_t width; // words per row
+        int64_t height; // rows
+        int64_t top;
+        int64_t bottom;
+        std::vector<uint64_t> words;
+
+        dense_bitworld() : x0(0), y0(0), width(0), height(0), top(0), bottom(0) { }
+
+        dense_bitworld(int64_t x0, int64_t y0, int64_t width, int64_t height) :
+            x0(x0), y0(y0), width(width), height(height), top(height), bottom(0),
+            words(width * height, 0) { }
+
+        // The smallest box (aligned to 8x8 tiles horizontally) containing a:
+        explicit dense_bitworld(bitworld &a) : dense_bitworld() {
+            int64_t bbox[4] = {0};
+            if (a.getbbox(bbox)) {
+                x0 = bbox[0] & (~7ll);
+                y0 = bbox[1];
+                width = (bbox[0] + bbox[2] - x0 + 63) >> 6;
+                height = bbox[3];
+                top = height;
+                words.assign(width * height, 0);
+                load(a);
+            }
+        }
+
+        // An empty world with the same box:
+        dense_bitworld blank() const {
+            return dense_bitworld(x0, y0, width, height);
+        }
+
+        uint64_t* row(int64_t r) { return &(words[r * width]); }
+        const uint64_t* row(int64_t r) const { return &(words[r * width]); }
+
+        void include_rows(int64_t r0, int64_t r1) {
+            if (r0 < top) { top = r0; }
+            if (r1 > bottom) { bottom = r1; }
+        }
+
+        // Adds the cells of a which lie within the box:
+        void load(const bitworld &a) {
+            for (auto it = a.world.begin(); it != a.world.end(); ++it) {
+                uint64_t tile = it->second;
+                if (tile == 0) { continue; }
+                int64_t x = ((int64_t) it->first.first) * 8 - x0;
+                int64_t y = ((int64_t) it->first.second) * 8 - y0;
+                if ((x < 0) || (x >= width * 64)) { continue; }
+                for (int64_t i = 0; i < 8; i++) {
+                    uint64_t bits = (tile >> (8 * i)) & 255;
+                    if ((bits == 0) || (y + i < 0) || (y + i >= height)) { continue; }
+                    row(y + i)[x >> 6] |= bits << (x & 63);
+                    include_rows(y + i, y + i + 1);
+                }
+            }
+        }
+
+        // Adds the cells of word i of row r which are set in mask to a:
+        void addword(bitworld &a, int64_t r, int64_t i, uint64_t mask) const {
+            uint64_t w = row(r)[i] & mask;
+            int32_t ty = (y0 + r) >> 3;
+            int64_t shift = ((y0 + r) & 7) * 8;
+            for (int64_t b = 0; (b < 8) && (w >> (8 * b)); b++) {
+                uint64_t bits = (w >> (8 * b)) & 255;
+                if (bits == 0) { continue; }
+                int32_t tx = (x0 + 64 * i + 8 * b) >> 3;
+                a.world[std::make_pair(tx, ty)] |= bits << shift;
+            }
+        }
+
+        bitworld tobitworld() const {
+            bitworld a;
+            for (int64_t r = top; r < bottom; r++) {
+                for (int64_t i = 0; i < width; i++) {
+                    if (row(r)[i]) { addword(a, r, i, -1); }
+                }
+            }
+            return a;
+        }
+
+        uint64_t population() const {
+            uint64_t pop = 0;
+            for (int64_t i = top * width; i < bottom * width; i++) {
+                pop += __builtin_popcountll(words[i]);
+            }
+            return pop;
+        }
+
+    };
+
+    /*
+     * The horizontal reach of a bleed by growth (as for grow_cluster) at
+     * each vertical offset 0, 1, ..., growth.length(), or -1 if it does
+     * not reach that far. Every bleed is symmetric and row-convex, so
+     * this determines it.
+     */
+    std::vector<int64_t> bleed_reach(const std::string &growth) {
+        int64_t radius = growth.length();
+        int64_t side = 2 * radius + 1;
+        std::vector<char> kernel(side * side, 0);
+        kernel[radius * side + radius] = 1;
+        for (uint64_t k = 0; k < growth.length(); k++) {
+            std::vector<char> next = kernel;
+            for (int64_t y = 0; y < side; y++) {
+                for (int64_t x = 0; x < side; x++) {
+                    if (kernel[y * side + x] == 0) { continue; }
+                    for (int64_t dy = -1; dy <= 1; dy++) {
+                        for (int64_t dx = -1; dx <= 1; dx++) {
+                            if ((growth[k] == '5') && (dx != 0) && (dy != 0)) { continue; }
+                            next[(y + dy) * side + x + dx] = 1;
+                        }
+                    }
+                }
+            }
+            kernel = next;
+        }
+        std::vector<int64_t> reach(radius + 1, -1);
+        for (int64_t dy = 0; dy <= radius; dy++) {
+            for (int64_t dx = 0; dx <= radius; dx++) {
+                if (kernel[(radius + dy) * side + radius + dx]) { reach[dy] = dx; }
+            }
+        }
+        return reach;
+    }
+
+    /*
+     * Separates the cells of live into the clusters which grow_cluster
+     * would find within env (a superset of live, with the same box), all
+     * at once: the maximal horizontal runs of env are united whenever
+     * the bleed reaches from one to the other, and each component with
+     * any live cells becomes a cluster. If wholes is given, it receives
+     * the whole component of env around each cluster. Clusters are in
+     * the order of their first live cell in a bitworld (by tile column,
+     * then tile row, then cell within the tile), which is the order in
+     * which repeatedly growing get1cell() would find them.
+     */
+    std::vector<bitworld> dense_clusters(const dense_bitworld &env, const dense_bitworld &live, const std::string &growth,
+                                            std::vector<bitworld> *wholes = 0) {
+
+        struct run { int64_t row; int64_t lo; int64_t hi; };
+        std::vector<run> runs;
+        std::vector<uint64_t> rowstart(env.height + 1, 0);
+
+        // Extract the runs of each row, in order:
+        for (int64_t r = 0; r < env.height; r++) {
+            rowstart[r] = runs.size();
+            if ((r < env.top) || (r >= env.bottom)) { continue; }
+            const uint64_t* w = env.row(r);
+            bool open = false;
+            for (int64_t i = 0; i < env.width; i++) {
+                uint64_t x = w[i];
+                if (x == 0) { open = false; continue; }
+                while (x) {
+                    int64_t start = __builtin_ctzll(x);
+                    uint64_t gaps = (~x) & ((~0ull) << start);
+                    int64_t end = (gaps == 0) ? 64 : __builtin_ctzll(gaps);
+                    if (open && (start == 0)) {
+                        runs.back().hi = 64 * i + end - 1;
+                    } else {
+                        run rn = {r, 64 * i + start, 64 * i + end - 1};
+                        runs.push_back(rn);
+                    }
+                    open = (end == 64);
+                    x = (end == 64) ? 0 : (x & ((~0ull) << end));
+                }
+            }
+        }
+        rowstart[env.height] = runs.size();
+
+        std::vector<int64_t> reach = bleed_reach(growth);
+        int64_t radius = growth.length();
+        dsds components(runs.size());
+
+        for (int64_t r = env.top; r < env.bottom; r++) {
+            uint64_t a0 = rowstart[r];
+            uint64_t a1 = rowstart[r + 1];
+
+            // Runs within the same row:
+            for (uint64_t a = a0 + 1; a < a1; a++) {
+                if (runs[a].lo - runs[a - 1].hi <= reach[0]) { components.merge(a - 1, a); }
+            }
+
+            // Runs in the rows below, within reach:
+            for (int64_t dy = 1; (dy <= radius) && (r + dy < env.height); dy++) {
+                int64_t h = reach[dy];
+                if (h < 0) { break; }
+                uint64_t a = a0;
+                for (uint64_t b = rowstart[r + dy]; b < rowstart[r + dy + 1]; b++) {
+                    while ((a < a1) && (runs[a].hi + h < runs[b].lo)) { a++; }
+                    for (uint64_t c = a; (c < a1) && (runs[c].lo - h <= runs[b].hi); c++) {
+                        components.merge(c, b);
+                    }
+                }
+            }
+        }
+
+        // Collect the live cells of each component:
+        std::vector<bitworld> clusters;
+        std::vector<int64_t> index(runs.size(), -1);
+        for (uint64_t k = 0; k < runs.size(); k++) {
+            const run &rn = runs[k];
+            uint64_t root = components.find(k);
+            for (int64_t i = (rn.lo >> 6); i <= (rn.hi >> 6); i++) {
+                uint64_t mask = -1;
+                if (i == (rn.lo >> 6)) { mask &= (~0ull) << (rn.lo & 63); }
+                if (i == (rn.hi >> 6)) { mask &= (~0ull) >> (63 - (rn.hi & 63)); }
+                if ((live.row(rn.row)[i] & mask) == 0) { continue; }
+                if (index[root] < 0) {
+                    index[root] = clusters.size();
+                    clusters.push_back(bitworld());
+                }
+                live.addword(clusters[index[root]], rn.row, i, mask);
+            }
+        }
+
+        if (wholes) {
+            wholes->assign(clusters.size(), bitworld());
+            for (uint64_t k = 0; k < runs.size(); k++) {
+                const run &rn = runs[k];
+                int64_t j = index[components.find(k)];
+                if (j < 0) { continue; }
+                for (int64_t i = (rn.lo >> 6); i <= (rn.hi >> 6); i++) {
+                    uint64_t mask = -1;
+                    if (i == (rn.lo >> 6)) { mask &= (~0ull) << (rn.lo & 63); }
+                    if (i == (rn.hi >> 6)) { mask &= (~0ull) >> (63 - (rn.hi & 63)); }
+                    env.addword((*wholes)[j], rn.row, i, mask);
+                }
+            }
+        }
+
+        // Sort the clusters by their first live cell:
+        std::vector<std::pair<std::pair<std::pair<int32_t, int32_t>, int>, uint64_t> > order;
+        for (uint64_t j = 0; j < clusters.size(); j++) {
+            auto it = clusters[j].world.begin();
+            order.emplace_back(std::make_pair(it->first, __builtin_ctzll(it->second)), j);
+        }
+        std::sort(order.begin(), order.end());
+        std::vector<bitworld> sorted(clusters.size());
+        std::vector<bitworld> sortedwholes(wholes ? clusters.size() : 0);
+        for (uint64_t j = 0; j < order.size(); j++) {
+            std::swap(sorted[j], clusters[order[j].second]);
+            if (wholes) { std::swap(sortedwholes[j], (*wholes)[order[j].second]); }
+        }
+        if (wholes) { wholes->swap(sortedwholes); }
+
+        return sorted;
+    }
+
+    /*
+     * The clusters of live within env (a superset of live), in the order
+     * in which repeatedly growing get1cell() would find them; each is the
+     * whole component of env if whole is set, or just its live cells.
+     * Ash in a modest box goes through dense_clusters, and sprawling ash
+     * through grow_cluster.
+     */
+    std::vector<bitworld> find_clusters(bitworld &live, bitworld &env, const std::string &growth, bool whole) {
+
+        int64_t bbox[4] = {0};
+        if (env.getbbox(bbox) && (((bbox[2] + 71) >> 6) * bbox[3] <= 262144)) {
+            dense_bitworld denv(env);
+            dense_bitworld dlive = denv.blank();
+            dlive.load(live);
+            if (!whole) { return dense_clusters(denv, dlive, growth); }
+            std::vector<bitworld> wholes;
+            dense_clusters(denv, dlive, growth, &wholes);
+            return wholes;
+        }
+
+        bitworld lrem = live;
+        std::vector<bitworld> clusters;
+        while (lrem.population() != 0) {
+            bitworld cluster = grow_cluster(lrem.get1cell(), env, growth);
+            if (!whole) { cluster &= lrem; }
+            lrem -= cluster;
+            clusters.push_back(cluster);
+        }
+        return clusters;
+    }
+
+}
@@ -0,0 +1,364 @@
+/*
+* A concurrent counterpart of kivtable, which any number of threads may
+* address at once; so a single hypertree can be shared by every worker,
+* and whatever one thread has memoised is found by all of the others.
+*
+* Lookups walk the chains without locking. Insertions lock one of 256
+* stripes of buckets and prepend to the chain, so a lookup which misses
+* is repeated under the lock before a node is made. Chains are never
+* reordered (there is no move-to-front), and nodes are drawn from 64
+* free lists, chosen by the calling thread, so threads rarely contend.
+*
+* Indices are stable, and entries are the same kiventry as in kivtable.
+* Resizing the hashtable locks every stripe; superseded hashtables are
+* only freed by gc_traverse, which (like erasenode) must not run while
+* other threads are using the table.
+*/
+
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include "kivtable.h"
+
+namespace apg {
+
+    // A small number, distinct for each of the first few threads to ask:
+    inline uint32_t thread_slot() {
+        static std::atomic<uint32_t> nextslot(0);
+        static thread_local uint32_t slot = nextslot++;
+        return slot;
+    }
+
+    template <typename K, typename I, typename V>
+    class ckivtable {
+
+        // Buckets and their number, published together when resized:
+        struct buckettable {
+            uint64_t hashprime;
+            I* heads;
+        };
+
+        struct freelist {
+            std::mutex mutex;
+            I freenodes;
+            uint64_t totalnodes;
+        };
+
+        // Block b of 4096 entries is found at blocks[b >> 10][b & 1023]:
+        kiventry<K, I, V>** blocks[1024];
+        uint64_t nblocks;
+        std::mutex blockmutex;
+
+        std::atomic<buckettable*> table;
+        std::vector<buckettable*> oldtables;
+        std::mutex stripes[256];
+        freelist freelists[64];
+
+        static I loadnext(kiventry<K, I, V>* pptr) {
+            return __atomic_load_n(&(pptr->next), __ATOMIC_ACQUIRE);
+        }
+
+        static I loadhead(buckettable* t, uint64_t h) {
+            return __atomic_load_n(t->heads + h, __ATOMIC_ACQUIRE);
+        }
+
+        // Index of the node with this key in the chain starting at p, or 0:
+        I findnode(K &key, I p) {
+            while (p) {
+                kiventry<K, I, V>* pptr = ind2ptr(p);
+                if (pptr->key == key) { return p; }
+                p = loadnext(pptr);
+            }
+            return 0;
+        }
+
+        // Allocate another 4096 entries, threaded onto the given free list:
+        void newblock(freelist &fl) {
+
+            kiventry<K, I, V>* nextarray;
+            if (posix_memalign((void**) &nextarray, 64, sizeof(kiventry<K, I, V>) << klowbits)) {
+                std::cerr << "Memory error!!!" << std::endl;
+                exit(1);
+            }
+            std::memset((void*) nextarray, 0, sizeof(kiventry<K, I, V>) << klowbits);
+
+            uint64_t b;
+            {
+                std::lock_guard<std::mutex> lock(blockmutex);
+                b = nblocks++;
+                if ((b >> 10) >= 1024) {
+                    std::cerr << "ckivtable is full!!!" << std::endl;
+                    exit(1);
+                }
+                if (blocks[b >> 10] == 0) {
+                    blocks[b >> 10] = (kiventry<K, I, V>**) calloc(1024, sizeof(kiventry<K, I, V>*));
+                }
+                blocks[b >> 10][b & 1023] = nextarray;
+            }
+
+            // Index zero is the null node, so is never handed out:
+            I first = (b << klowbits) + (b == 0);
+            I last = (b << klowbits) + ((1 << klowbits) - 1);
+            for (I i = first; i < last; i++) {
+                ind2ptr(i)->next = i + 1;
+            }
+            ind2ptr(last)->next = fl.freenodes;
+            fl.freenodes = first;
+        }
+
+        // Take a node from this thread's free list, noting whether it grew:
+        I newnode(K &key, I next, bool &grew) {
+
+            freelist &fl = freelists[thread_slot() & 63];
+            std::lock_guard<std::mutex> lock(fl.mutex);
+            if (fl.freenodes == 0) { newblock(fl); grew = true; }
+            I r = fl.freenodes;
+            kiventry<K, I, V>* fptr = ind2ptr(r);
+            fl.freenodes = fptr->next;
+            fptr->key = key;
+            fptr->next = next;
+            __atomic_add_fetch(&(fl.totalnodes), 1, __ATOMIC_RELAXED);
+            return r;
+        }
+
+        void resize_if_necessary() {
+            uint64_t hashprime = table.load(std::memory_order_acquire)->hashprime;
+            if (size() > hashprime) {
+                resize_hash(apg::nextprime(hashprime * 3));
+            }
+        }
+
+        static buckettable* newtable(uint64_t hashprime) {
+            buckettable* t = new buckettable;
+            t->hashprime = hashprime;
+            if (posix_memalign((void**) &(t->heads), 64, sizeof(I) * hashprime)) {
+                std::cerr << "Memory error!!!" << std::endl;
+                exit(1);
+            }
+            std::memset(t->heads, 0, sizeof(I) * hashprime);
+            return t;
+        }
+
+        public:
+        I gccounter;
+
+        // Convert index to pointer:
+        kiventry<K, I, V>* ind2ptr(I index) {
+            uint64_t b = ((uint64_t) index) >> klowbits;
+            return (blocks[b >> 10][b & 1023] + (index & ((1 << klowbits) - 1)));
+        }
+
+        uint64_t max_size() {
+            return ((uint64_t) 1) << (20 + klowbits);
+        }
+
+        void resize_hash(uint64_t newprime) {
+
+            for (int i = 0; i < 256; i++) { stripes[i].lock(); }
+
+            buckettable* oldtable = table.load(std::memory_order_relaxed);
+            if (newprime > oldtable->hashprime) {
+
+                buckettable* t = newtable(newprime);
+
+                // Nodes which are relinked mid-lookup only cause a miss,
+                // which is then repeated under the stripe lock:
+                for (uint64_t i = 0; i < oldtable->hashprime; i++) {
+                    I p = oldtable->heads[i];
+                    while (p) {
+                        kiventry<K, I, V>* pptr = ind2ptr(p);
+                        I np = pptr->next;
+                        uint64_t h = pptr->key.hash() % newprime;
+                        __atomic_store_n(&(pptr->next), t->heads[h], __ATOMIC_RELEASE);
+                        t->heads[h] = p;
+                        p = np;
+                    }
+                }
+
+                table.store(t, std::memory_order_release);
+                oldtables.push_back(oldtable);
+            }
+
+            for (int i = 255; i >= 0; i--) { stripes[i].unlock(); }
+        }
+
+        uint64_t size() {
+            uint64_t n = 0;
+            for (int i = 0; i < 64; i++) {
+                n += __atomic_load_n(&(freelists[i].totalnodes), __ATOMIC_RELAXED);
+            }
+            return n;
+        }
+
+        // One more than the largest index yet allocated:
+        uint64_t capacity() {
+            std::lock_guard<std::mutex> lock(blockmutex);
+            return nblocks << klowbits;
+        }
+
+        uint64_t total_bytes() {
+            uint64_t nodemem = sizeof(kiventry<K, I, V>) * size();
+            uint64_t hashmem = sizeof(I) * table.load(std::memory_order_acquire)->hashprime;
+            return (nodemem + hashmem);
+        }
+
+        bool erasenode(K key) {
+
+            if (key.iszero()) { return 0; }
+            buckettable* t = table.load(std::memory_order_acquire);
+            uint64_t h = key.hash() % t->hashprime;
+
+            I p = t->heads[h];
+            kiventry<K, I, V>* predptr = 0;
+            while (p) {
+                kiventry<K, I, V>* pptr = ind2ptr(p);
+                if (pptr->key == key) {
+
+                    // Remove from hashtable:
+                    if (predptr) {
+                        predptr->next = pptr->next;
+                    } else {
+                        t->heads[h] = pptr->next;
+                    }
+
+                    // Reset memory and return to this thread's free list:
+                    std::memset((void*) pptr, 0, sizeof(kiventry<K, I, V>));
+                    freelist &fl = freelists[thread_slot() & 63];
+                    pptr->next = fl.freenodes;
+                    fl.freenodes = p;
+                    fl.totalnodes -= 1;
+                    return true;
+                }
+                predptr = pptr;
+                p = pptr->next;
+            }
+
+            // Node did not exist ab initio:
+            return false;
+        }
+
+        // Get node index from key:
+        I getnode(K key, bool makenew) {
+
+            // If the key is zero, return zero; otherwise make a right hash:
+            if (key.iszero()) { return 0; }
+            uint64_t hk = key.hash();
+
+            buckettable* t = table.load(std::memory_order_acquire);
+            I p = findnode(key, loadhead(t, hk % t->hashprime));
+            if (p) { return p; }
+
+            bool grew = false;
+            for (;;) {
+                uint64_t h = hk % t->hashprime;
+                std::lock_guard<std::mutex> lock(stripes[h & 255]);
+                buckettable* t2 = table.load(std::memory_order_acquire);
+                if (t2 != t) { t = t2; continue; } // resized meanwhile
+
+                I head = t->heads[h];
+                p = findnode(key, head);
+                if (p) { return p; }
+                if (!makenew) { return -1; }
+
+                p = newnode(key, head, grew);
+                __atomic_store_n(t->heads + h, p, __ATOMIC_RELEASE);
+                break;
+            }
+
+            // The load factor only needs checking when memory grows, and
+            // outside the stripe lock, as resizing takes every stripe:
+            if (grew) { resize_if_necessary(); }
+            return p;
+        }
+
+        // Create a (key, value) pair and return index:
+        I setnode(K key, V value) {
+            I p = getnode(key, true);
+            if (p) { ind2ptr(p)->value = value; }
+            return p;
+        }
+
+        void gc_traverse(bool destructive) {
+            /*
+            * Run gc_traverse(false) to zero all gcflags;
+            * Run gc_traverse(true) to delete all items with zero gcflags.
+            */
+
+            while (!oldtables.empty()) {
+                free(oldtables.back()->heads);
+                delete oldtables.back();
+                oldtables.pop_back();
+            }
+
+            buckettable* t = table.load(std::memory_order_acquire);
+            for (uint64_t i = 0; i < t->hashprime; i++) {
+                I p = t->heads[i];
+                kiventry<K, I, V>* predptr = 0;
+                freelist &fl = freelists[i & 63];
+                while (p) {
+                    kiventry<K, I, V>* pptr = ind2ptr(p);
+                    I np = pptr->next;
+                    if (destructive && pptr->gcflags == 0) {
+                        // Remove from hashtable:
+                        if (predptr) {
+                            predptr->next = np;
+                        } else {
+                            t->heads[i] = np;
+                        }
+
+                        // Reset memory and spread over the free lists:
+                        std::memset((void*) pptr, 0, sizeof(kiventry<K, I, V>));
+                        pptr->next = fl.freenodes;
+                        fl.freenodes = p;
+                        fl.totalnodes -= 1;
+                    } else {
+                        // Node still exists; zero the flags:
+                        pptr->gcflags = 0;
+                        predptr = pptr;
+                    }
+                    p = np;
+                }
+            }
+
+            gccounter = 0;
+        }
+
+        void init(uint64_t hashprime) {
+            std::memset(blocks, 0, sizeof(blocks));
+            nblocks = 0;
+            table.store(newtable(hashprime));
+            for (int i = 0; i < 64; i++) {
+                freelists[i].freenodes = 0;
+                freelists[i].totalnodes = 0;
+            }
+            gccounter = 0;
+        }
+
+        ckivtable(uint64_t hashprime) { init(hashprime); }
+
+        ckivtable() { init(3511); /* Wieferich prime */ }
+
+        ~ckivtable() {
+
+            for (uint64_t b = 0; b < nblocks; b++) {
+                free(blocks[b >> 10][b & 1023]);
+            }
+            for (int i = 0; i < 1024; i++) {
+                free(blocks[i]);
+            }
+
+            oldtables.push_back(table.load());
+            while (!oldtables.empty()) {
+                free(oldtables.back()->heads);
+                delete oldtables.back();
+                oldtables.pop_back();
+            }
+        }
+
+    };
+
+}
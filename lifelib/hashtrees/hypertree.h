@@ -18,16 +18,23 @@
 *
 * *Nodes in each layer have separate sets of indices, so you can have up
 * to 4 billion nodes in each layer.
+*
+* T is the hashtable template for each layer. With ckivtable, any number
+* of threads may make nodes in the same forest at once; handles and
+* garbage-collection must still be confined to one thread at a time.
 */
 
 #pragma once
 
 #include "nicearray.h"
 #include "kivtable.h"
+#include "ckivtable.h"
 #include <stdint.h>
 #include <cstdarg>
 #include <string>
 #include <map>
+#include <atomic>
+#include <mutex>
 
 namespace apg {
 
@@ -47,12 +54,34 @@ namespace apg {
         }
     };
 
-    template<typename I, int N, typename NV, typename LK, typename LV>
+    /*
+    * The node (one layer down) which a non-leaf's value refers to, if any,
+    * besides its children; values which do so overload this, so that the
+    * incremental garbage-collector keeps the node alive.
+    */
+    template<typename NV, typename I>
+    I gc_reference(const NV &value, I gcflags) { return 0; }
+
+    template<typename I, int N, typename NV, typename LK, typename LV,
+             template<typename, typename, typename> class T = kivtable>
     class hypertree {
 
         // We store a kivtable for each layer in our hypertree:
-        std::vector<kivtable<nicearray<I, N>, I, NV>* > nonleaves;
-        kivtable<LK, I, LV> leaves;
+        std::vector<T<nicearray<I, N>, I, NV>* > nonleaves;
+        T<LK, I, LV> leaves;
+
+        // Layers are added under a lock, into space reserved in advance so
+        // that other threads can go on reading nonleaves:
+        std::atomic<uint32_t> nlayers;
+        std::mutex layermutex;
+
+        void addlayers(uint32_t depth) {
+            std::lock_guard<std::mutex> lock(layermutex);
+            while (nonleaves.size() < depth) {
+                nonleaves.push_back(new T<nicearray<I, N>, I, NV>);
+            }
+            nlayers.store(nonleaves.size(), std::memory_order_release);
+        }
 
         public:
 
@@ -64,11 +93,42 @@ namespace apg {
             return n;
         }
 
-        // Maps symbol to a node in the hypertree:
-        uint64_t hcounter;
-        std::map<uint64_t, hypernode<I> > ihandles;
+        // Maps symbol to a node in the hypertree. Integer handles index a
+        // vector of slots (offset by one), and vacated slots are reused:
+        std::vector<hypernode<I> > ihandles;
+        std::vector<uint64_t> freeihandles;
         std::map<std::string, hypernode<I> > handles;
 
+        uint64_t newihandle(hypernode<I> hnode) {
+            if (gcphase != GC_IDLE) { gc_shade(hnode); }
+            if (freeihandles.empty()) {
+                ihandles.push_back(hnode);
+                return ihandles.size();
+            }
+            uint64_t x = freeihandles.back();
+            freeihandles.pop_back();
+            ihandles[x - 1] = hnode;
+            return x;
+        }
+
+        void sethandle(uint64_t ihandle, hypernode<I> hnode) {
+            if (gcphase != GC_IDLE) { gc_shade(hnode); }
+            ihandles[ihandle - 1] = hnode;
+        }
+
+        void delhandle(uint64_t ihandle) {
+            ihandles[ihandle - 1] = hypernode<I>();
+            freeihandles.push_back(ihandle);
+        }
+
+        hypernode<I> gethandle(uint64_t ihandle) {
+            return ihandles[ihandle - 1];
+        }
+
+        uint64_t counthandles() {
+            return ihandles.size() - freeihandles.size() + handles.size();
+        }
+
         // Wrapper for nonleaves.ind2ptr:
         kiventry<nicearray<I, N>, I, NV>* ind2ptr_nonleaf(uint32_t depth, I index) {
             return nonleaves[depth-1]->ind2ptr(index);
@@ -128,40 +188,173 @@ namespace apg {
         }
 
         void gc_full() {
+            // Supersedes any incremental collection in progress:
+            gcphase = GC_IDLE;
+            gcgreys.clear();
+            gcmarks.clear();
+
             gc_traverse(false);
             for (typename std::map<std::string, hypernode<I> >::iterator it = handles.begin(); it != handles.end(); ++it) {
                 gc_mark(it->second);
             }
-            for (typename std::map<uint64_t, hypernode<I> >::iterator it = ihandles.begin(); it != ihandles.end(); ++it) {
-                gc_mark(it->second);
+            for (uint64_t i = 0; i < ihandles.size(); i++) {
+                gc_mark(ihandles[i]);
             }
             gc_traverse(true);
         }
 
+        /*
+        * Incremental garbage-collection, for callers which cannot afford to
+        * stop while gc_full visits every node. A cycle begins by marking the
+        * nodes held by handles, then works in steps of bounded length: first
+        * tracing from the marked nodes, then sweeping the layers from the top
+        * down, each in index order, to erase the unmarked nodes.
+        *
+        * Nodes are immutable, so whatever was reachable when the cycle began
+        * is marked eventually. In between steps, every node made or found by
+        * make_leaf or make_nonleaf, or given a handle, is marked as well (and
+        * its descendants traced before the sweep resumes); so are nodes that
+        * gc_reference says a value refers to. Sweeping from the top down
+        * ensures that an unmarked node found again has all its descendants.
+        * Marks are kept apart from the gcflags, so values cached there
+        * survive the collection.
+        */
+        enum { GC_IDLE, GC_MARKING, GC_SWEEPING };
+        int gcphase;
+
+        private:
+
+        std::vector<std::vector<uint64_t> > gcmarks; // by depth; 0 is leaves
+        std::vector<hypernode<I> > gcgreys; // marked but not yet traced
+        uint32_t sweepdepth;
+        uint64_t sweepindex;
+
+        void gc_shade(hypernode<I> hnode) {
+            if (hnode.index == 0 || hnode.index == ((I) -1)) { return; }
+            if (hnode.depth >= gcmarks.size()) { gcmarks.resize(hnode.depth + 1); }
+            std::vector<uint64_t> &marks = gcmarks[hnode.depth];
+            uint64_t w = ((uint64_t) hnode.index) >> 6;
+            if (w >= marks.size()) { marks.resize(w + 1 + (w >> 1)); }
+            uint64_t bit = 1ull << (hnode.index & 63);
+            if ((marks[w] & bit) == 0) {
+                marks[w] |= bit;
+                if (hnode.depth) { gcgreys.push_back(hnode); }
+            }
+        }
+
+        void gc_scan(hypernode<I> hnode) {
+            kiventry<nicearray<I, N>, I, NV>* pptr = ind2ptr_nonleaf(hnode.depth, hnode.index);
+            for (int i = 0; i < N; i++) {
+                gc_shade(hypernode<I>(pptr->key.x[i], hnode.depth - 1));
+            }
+            I r = gc_reference(pptr->value, pptr->gcflags);
+            if (r) { gc_shade(hypernode<I>(r, hnode.depth - 1)); }
+        }
+
+        // Erase unmarked nodes of one layer, returning true when finished:
+        template<typename Table>
+        bool gc_sweep(Table* table, uint32_t depth, int64_t &budget) {
+            if (depth >= gcmarks.size()) { gcmarks.resize(depth + 1); }
+            const std::vector<uint64_t> &marks = gcmarks[depth];
+            uint64_t capacity = table->capacity();
+            for (; sweepindex < capacity; sweepindex++) {
+                if (budget-- <= 0) { return false; }
+                uint64_t w = sweepindex >> 6;
+                if ((w < marks.size()) && ((marks[w] >> (sweepindex & 63)) & 1)) { continue; }
+                auto pptr = table->ind2ptr(sweepindex);
+                if (!(pptr->key.iszero())) { table->erasenode(pptr->key); }
+            }
+            return true;
+        }
+
+        public:
+
+        void gc_begin() {
+            if (gcphase != GC_IDLE) { return; }
+            gcphase = GC_MARKING;
+            gcmarks.assign(nonleaves.size() + 1, std::vector<uint64_t>());
+            gcmarks[0].resize((leaves.capacity() >> 6) + 1);
+            for (unsigned int i = 0; i < nonleaves.size(); i++) {
+                gcmarks[i + 1].resize((nonleaves[i]->capacity() >> 6) + 1);
+            }
+            for (typename std::map<std::string, hypernode<I> >::iterator it = handles.begin(); it != handles.end(); ++it) {
+                gc_shade(it->second);
+            }
+            for (uint64_t i = 0; i < ihandles.size(); i++) {
+                gc_shade(ihandles[i]);
+            }
+        }
+
+        // Do up to budget units of work, returning true if the cycle ends:
+        bool gc_step(int64_t budget) {
+
+            if (gcphase == GC_MARKING) {
+                while (!gcgreys.empty()) {
+                    if (budget-- <= 0) { return false; }
+                    hypernode<I> hnode = gcgreys.back();
+                    gcgreys.pop_back();
+                    gc_scan(hnode);
+                }
+                gcphase = GC_SWEEPING;
+                sweepdepth = nonleaves.size();
+                sweepindex = 1;
+            }
+
+            if (gcphase == GC_SWEEPING) {
+                // Nodes found again since the last step keep their descendants:
+                while (!gcgreys.empty()) {
+                    hypernode<I> hnode = gcgreys.back();
+                    gcgreys.pop_back();
+                    gc_scan(hnode);
+                }
+                for (;;) {
+                    bool finished = sweepdepth ? gc_sweep(nonleaves[sweepdepth - 1], sweepdepth, budget)
+                                               : gc_sweep(&leaves, 0, budget);
+                    if (!finished) { return false; }
+                    if (sweepdepth == 0) { break; }
+                    sweepdepth -= 1;
+                    sweepindex = 1;
+                }
+                gcphase = GC_IDLE;
+                std::vector<std::vector<uint64_t> >().swap(gcmarks);
+                return true;
+            }
+
+            return false;
+        }
+
         I make_leaf(LK contents) {
-            return leaves.getnode(contents, true);
+            I index = leaves.getnode(contents, true);
+            if (gcphase != GC_IDLE) { gc_shade(hypernode<I>(index, 0)); }
+            return index;
         }
 
         I make_nonleaf(uint32_t depth, nicearray<I, N> indices) {
-            while (nonleaves.size() < depth) {
+            if (nlayers.load(std::memory_order_acquire) < depth) {
                 // std::cout << "Adding layer " << (nonleaves.size() + 1) << "..." << std::endl;
-                nonleaves.push_back(new kivtable<nicearray<I, N>, I, NV>);
+                addlayers(depth);
                 // std::cout << "...done!" << std::endl;
             }
             // std::cout << depth << std::endl;
-            return nonleaves[depth-1]->getnode(indices, true);
+            I index = nonleaves[depth-1]->getnode(indices, true);
+            if (gcphase != GC_IDLE) { gc_shade(hypernode<I>(index, depth)); }
+            return index;
         }
 
         hypernode<I> make_nonleaf_hn(uint32_t depth, nicearray<I, N> indices) {
             return hypernode<I>(make_nonleaf(depth, indices), depth);
         }
 
-        hypertree() { hcounter = 0; }
+        hypertree() {
+            gcphase = GC_IDLE;
+            nlayers = 0;
+            nonleaves.reserve(256);
+        }
 
         ~hypertree() {
             // std::cout << "Deleting nonleaves..." << std::endl;
             while (nonleaves.size()) {
-                kivtable<nicearray<I, N>, I, NV>* lastktable = nonleaves.back();
+                T<nicearray<I, N>, I, NV>* lastktable = nonleaves.back();
                 delete lastktable;
                 nonleaves.pop_back();
             }
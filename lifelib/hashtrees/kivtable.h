@@ -2,6 +2,12 @@
 * (key, index, value) hashtables that can be addressed by either the
 * key (like a regular associative array) or the (typically 32-bit)
 * index integer.
+*
+* kivtable has a prime number of buckets, tripled (and rehashed all at
+* once) whenever the nodes outnumber them. p2kivtable has a power of two
+* instead, indexed by the low bits of a mixed hash rather than by a
+* division; it doubles as required, but moves the nodes over a few
+* buckets per insertion, so no single insertion has to rehash the lot.
 */
 
 #pragma once
@@ -32,15 +38,66 @@ namespace apg {
 
     };
 
-    template <typename K, typename I, typename V>
-    class kivtable {
+    // Spreads a key's hash over the low bits used to index p2kivtable:
+    inline uint64_t mixhash(uint64_t h) {
+        h ^= (h >> 33);
+        h *= 0xff51afd7ed558ccdull;
+        h ^= (h >> 33);
+        return h;
+    }
+
+    template <typename K, typename I, typename V, bool P2>
+    class basic_kivtable {
 
         std::vector<kiventry<K, I, V>*> arraylist;
-        uint64_t hashprime;
+        uint64_t hashprime; // the number of buckets, prime unless P2
         uint64_t totalnodes;
         I* hashtable;
         I freenodes;
 
+        // Buckets of the superseded hashtable (if P2) below migrated
+        // have already been moved into hashtable:
+        I* oldtable;
+        uint64_t oldsize;
+        uint64_t migrated;
+
+        // The head of the chain in which the key belongs:
+        I* bucket(K &key) {
+            uint64_t h = key.hash();
+            if (!P2) { return hashtable + (h % hashprime); }
+            h = mixhash(h);
+            if (oldtable) {
+                uint64_t b = h & (oldsize - 1);
+                if (b >= migrated) { return oldtable + b; }
+            }
+            return hashtable + (h & (hashprime - 1));
+        }
+
+        // Move n more buckets of the old hashtable into the new one; old
+        // bucket b splits into new buckets b and b + oldsize, which are
+        // zeroed here rather than all at once when the table doubles:
+        void migrate(uint64_t n) {
+            uint64_t end = migrated + n;
+            if (end > oldsize) { end = oldsize; }
+            for (; migrated < end; migrated++) {
+                hashtable[migrated] = 0;
+                hashtable[migrated + oldsize] = 0;
+                I p = oldtable[migrated];
+                while (p) {
+                    kiventry<K, I, V>* pptr = ind2ptr(p);
+                    I np = pptr->next;
+                    uint64_t h = mixhash(pptr->key.hash()) & (hashprime - 1);
+                    pptr->next = hashtable[h];
+                    hashtable[h] = p;
+                    p = np;
+                }
+            }
+            if (migrated == oldsize) {
+                free(oldtable);
+                oldtable = 0;
+            }
+        }
+
         public:
         I gccounter;
 
@@ -53,6 +110,7 @@ namespace apg {
             return arraylist.max_size();
         }
 
+        // Rehash all at once into newprime buckets (kivtable only):
         void resize_hash(uint64_t newprime) {
 
             if (newprime == hashprime) {
@@ -89,7 +147,22 @@ namespace apg {
         private:
 
         void resize_if_necessary() {
-            if (totalnodes > hashprime) {
+            if (P2) {
+                if (oldtable) {
+                    // Twice as many buckets as insertions finishes the move
+                    // well before the new hashtable fills up:
+                    migrate(2);
+                } else if (totalnodes * 2 > hashprime) {
+                    oldtable = hashtable;
+                    oldsize = hashprime;
+                    migrated = 0;
+                    if (posix_memalign((void**) &hashtable, 64, sizeof(I) * oldsize * 2)) {
+                        std::cerr << "Memory error!!!" << std::endl;
+                        exit(1);
+                    }
+                    hashprime = oldsize * 2;
+                }
+            } else if (totalnodes > hashprime) {
                 uint64_t newprime = apg::nextprime(hashprime * 3);
                 // std::cerr << "Resizing hashtable to size " << newprime << " ... ";
                 resize_hash(newprime);
@@ -148,18 +221,23 @@ namespace apg {
             return totalnodes;
         }
 
+        // One more than the largest index yet allocated:
+        uint64_t capacity() {
+            return arraylist.size() << klowbits;
+        }
+
         uint64_t total_bytes() {
             uint64_t nodemem = sizeof(kiventry<K, I, V>) * totalnodes;
-            uint64_t hashmem = sizeof(I) * hashprime;
+            uint64_t hashmem = sizeof(I) * (hashprime + (oldtable ? oldsize : 0));
             return (nodemem + hashmem);
         }
 
         bool erasenode(K key) {
 
             if (key.iszero()) { return 0; }
-            uint64_t h = key.hash() % hashprime;
+            I* head = bucket(key);
 
-            I p = hashtable[h];
+            I p = *head;
             kiventry<K, I, V>* predptr = 0;
             while (p) {
                 kiventry<K, I, V>* pptr = ind2ptr(p);
@@ -169,11 +247,11 @@ namespace apg {
                     if (predptr) {
                         predptr->next = pptr->next;
                     } else {
-                        hashtable[h] = pptr->next;
+                        *head = pptr->next;
                     }
 
                     // Reset memory:
-                    std::memset(pptr, 0, sizeof(kiventry<K, I, V>));
+                    std::memset((void*) pptr, 0, sizeof(kiventry<K, I, V>));
 
                     // Prepend to list of free nodes:
                     pptr->next = freenodes;
@@ -183,6 +261,8 @@ namespace apg {
                     totalnodes -= 1;
                     return true;
                 }
+                predptr = pptr;
+                p = pptr->next;
             }
 
             // Node did not exist ab initio:
@@ -194,9 +274,9 @@ namespace apg {
 
             // If the key is zero, return zero; otherwise make a right hash:
             if (key.iszero()) { return 0; }
-            uint64_t h = key.hash() % hashprime;
+            I* head = bucket(key);
 
-            I p = hashtable[h];
+            I p = *head;
             kiventry<K, I, V>* predptr = 0;
             while (p) {
                 kiventry<K, I, V>* pptr = ind2ptr(p);
@@ -204,8 +284,8 @@ namespace apg {
                     if (predptr) {
                         // Move this node to the front:
                         predptr->next = pptr->next;
-                        pptr->next = hashtable[h];
-                        hashtable[h] = p;
+                        pptr->next = *head;
+                        *head = p;
                     }
                     return p;
                 }
@@ -213,8 +293,8 @@ namespace apg {
                 p = pptr->next;
             }
             if (makenew) {
-                p = newnode(key, hashtable[h]);
-                hashtable[h] = p;
+                p = newnode(key, *head);
+                *head = p;
                 resize_if_necessary();
                 return p;
             } else {
@@ -227,9 +307,9 @@ namespace apg {
 
             // If the key is zero, return zero; otherwise make a right hash:
             if (key.iszero()) { return 0; }
-            uint64_t h = key.hash() % hashprime;
+            I* head = bucket(key);
 
-            I p = hashtable[h];
+            I p = *head;
             kiventry<K, I, V>* predptr = 0;
             while (p) {
                 kiventry<K, I, V>* pptr = ind2ptr(p);
@@ -239,16 +319,16 @@ namespace apg {
                     if (predptr) {
                         // Move this node to the front:
                         predptr->next = pptr->next;
-                        pptr->next = hashtable[h];
-                        hashtable[h] = p;
+                        pptr->next = *head;
+                        *head = p;
                     }
                     return p;
                 }
                 predptr = pptr;
                 p = pptr->next;
             }
-            p = newnode(key, hashtable[h], value);
-            hashtable[h] = p;
+            p = newnode(key, *head, value);
+            *head = p;
             resize_if_necessary();
             return p;
         }
@@ -259,6 +339,8 @@ namespace apg {
             * Run gc_traverse(true) to delete all items with zero gcflags.
             */
 
+            if (oldtable) { migrate(oldsize); }
+
             for (uint64_t i = 0; i < hashprime; i++) {
                 I p = hashtable[i];
                 kiventry<K, I, V>* predptr = 0;
@@ -300,7 +382,13 @@ namespace apg {
 
             // std::cout << "Initialising kivtable with p = " << hashprime << std::endl;
 
+            // A power of two at least as large as the prime requested:
+            if (P2) { hashprime = 1ull << (64 - __builtin_clzll(hashprime - 1)); }
+
             this->hashprime = hashprime;
+            oldtable = 0;
+            oldsize = 0;
+            migrated = 0;
             if (posix_memalign((void**) &hashtable, 64, sizeof(I) * hashprime)) {
                 std::cerr << "Memory error!!!" << std::endl;
                 exit(1);
@@ -325,11 +413,11 @@ namespace apg {
             freenodes = 1;
         }
 
-        kivtable(uint64_t hashprime) { init(hashprime); }
+        basic_kivtable(uint64_t hashprime) { init(hashprime); }
 
-        kivtable() { init(3511); /* Wieferich prime */ }
+        basic_kivtable() { init(3511); /* Wieferich prime */ }
 
-        ~kivtable() {
+        ~basic_kivtable() {
 
             // std::cout << "Calling destructor" << std::endl;
 
@@ -341,11 +429,18 @@ namespace apg {
 
             // Free the hashtable itself:
             free(hashtable);
+            free(oldtable);
 
         }
 
     };
 
+    template <typename K, typename I, typename V>
+    using kivtable = basic_kivtable<K, I, V, false>;
+
+    template <typename K, typename I, typename V>
+    using p2kivtable = basic_kivtable<K, I, V, true>;
+
     /*
     template <typename K, typename V>
     using kivtable32 = kivtable<K, uint32_t, V>;
@@ -0,0 +1,73 @@
+/*
+* Has several threads make the same nodes in a shared ckivtable, in
+* different orders, and checks that they all agree:
+*
+* g++ -O3 -march=native -fopenmp --std=c++11 test_ckivtable.cpp -o test_ckivtable
+*/
+
+#include <iostream>
+#include <omp.h>
+#include "hypertree.h"
+
+int main() {
+
+    typedef apg::nicearray<uint32_t, 4> uint32x4;
+    const uint32_t n = 300000;
+    const int m = 8;
+
+    apg::ckivtable<uint32x4, uint32_t, uint32_t> table;
+    std::vector<std::vector<uint32_t> > indices(m, std::vector<uint32_t>(n));
+
+    #pragma omp parallel num_threads(m)
+    {
+        int t = omp_get_thread_num();
+        for (uint32_t i = 0; i < n; i++) {
+            // Each thread visits the keys in its own order:
+            uint32_t j = (i * 7919u + t * 104729u) % n;
+            uint32_t k = table.getnode(uint32x4(j + 1, j * 3, 7u, (uint32_t) (t & 1)), true);
+            indices[t][j] = k;
+        }
+    }
+
+    int failures = 0;
+    std::vector<char> seen(table.max_size() >> 12);
+    for (uint32_t j = 0; j < n; j++) {
+        uint32_t k = indices[0][j];
+        for (int t = 1; t < m; t++) {
+            uint32_t expected = indices[t & 1][j];
+            if (indices[t][j] != expected) { failures += 1; }
+        }
+        apg::kiventry<uint32x4, uint32_t, uint32_t>* pptr = table.ind2ptr(k);
+        if (!(pptr->key == uint32x4(j + 1, j * 3, 7u, 0u))) { failures += 1; }
+        if (table.getnode(uint32x4(j + 1, j * 3, 7u, 1u), false) != indices[1][j]) { failures += 1; }
+    }
+    if (table.size() != 2 * n) { failures += 1; }
+
+    // Threads building the same forest arrive at the same root:
+    apg::hypertree<uint32_t, 4, uint32_t, uint32x4, uint32_t, apg::ckivtable> htree;
+    std::vector<uint32_t> roots(m);
+
+    #pragma omp parallel num_threads(m)
+    {
+        int t = omp_get_thread_num();
+        std::vector<uint32_t> layer(4096);
+        for (uint32_t i = 0; i < 4096; i++) {
+            layer[i] = htree.make_leaf(uint32x4(i % 37 + 1, i % 11, 0u, 0u));
+        }
+        for (uint32_t depth = 1; layer.size() > 1; depth++) {
+            std::vector<uint32_t> next(layer.size() / 4);
+            for (uint32_t i = 0; i < next.size(); i++) {
+                next[i] = htree.make_nonleaf(depth, uint32x4(layer[4*i], layer[4*i+1], layer[4*i+2], layer[4*i+3]));
+            }
+            layer.swap(next);
+        }
+        roots[t] = layer[0];
+    }
+
+    for (int t = 1; t < m; t++) {
+        if (roots[t] != roots[0]) { failures += 1; }
+    }
+
+    std::cout << (failures ? "FAILED" : "ok") << std::endl;
+    return (failures != 0);
+}
@@ -204,8 +204,8 @@ namespace apg {
 
     void copycells(upattern<VTile28, 28>* curralgo, incubator<56, 56>* destalgo) {
 
-        for (auto it = curralgo->tiles.begin(); it != curralgo->tiles.end(); ++it) {
-            VTile28* sqt = &(it->second);
+        for (uint64_t i = 0; i < curralgo->tilecount; i++) {
+            VTile28* sqt = curralgo->tileptr(i);
             int64_t tx = (sqt->coords & 0xffffffffu) - 0x80000000u;
             int64_t tw = (sqt->coords >> 32) - 0x80000000u;
 
@@ -12,35 +12,38 @@
 
 namespace apg {
 
-    template<typename I, int N>
+    /*
+    * T chooses the hashtable used for each layer of the forest: kivtable,
+    * or p2kivtable, which avoids a division per node and never pauses to
+    * rehash the whole layer at once.
+    */
+    template<typename I, int N, template<typename, typename, typename> class T = kivtable>
     class lifetree : public lifetree_abstract<I> {
 
         public:
-        hypertree<I, 4, lifemeta<I>, nicearray<uint64_t, 4*N>, lifemeta<I> > htree;
+        hypertree<I, 4, lifemeta<I>, nicearray<uint64_t, 4*N>, lifemeta<I>, T> htree;
 
         uint64_t countlayers() {
             return N;
         }
 
         uint64_t newihandle(hypernode<I> hnode) {
-            uint64_t x = ++htree.hcounter;
-            htree.ihandles.emplace(x, hnode);
-            return x;
+            return htree.newihandle(hnode);
         }
         void sethandle(uint64_t ihandle, hypernode<I> hnode) {
-            htree.ihandles[ihandle] = hnode;
+            htree.sethandle(ihandle, hnode);
         }
         void sethandle(std::string handle, hypernode<I> hnode) {
             htree.handles[handle] = hnode;
         }
         void delhandle(uint64_t ihandle) {
-            htree.ihandles.erase(ihandle);
+            htree.delhandle(ihandle);
         }
         void delhandle(std::string handle) {
             htree.handles.erase(handle);
         }
         hypernode<I> gethandle(uint64_t ihandle) {
-            return htree.ihandles[ihandle];
+            return htree.gethandle(ihandle);
         }
         hypernode<I> gethandle(std::string handle) {
             return htree.handles[handle];
@@ -48,13 +51,22 @@ namespace apg {
 
         uint64_t total_bytes() { return htree.total_bytes(); }
         void force_gc() { htree.gc_full(); }
+
+        /*
+        * Collects garbage incrementally once the threshold is reached, doing
+        * a bounded amount of work per call; the rest of the cycle is left to
+        * subsequent calls, unless memory reaches twice the threshold first.
+        */
         bool threshold_gc(uint64_t threshold) {
             if (threshold) {
                 uint64_t oldsize = htree.total_bytes();
-                if (oldsize >= threshold) {
+                if (htree.gcphase != htree.GC_IDLE) {
+                    htree.gc_step((oldsize >= 2 * threshold) ? INT64_MAX : 65536);
+                    return true;
+                } else if (oldsize >= threshold) {
                     // std::cerr << "Performing garbage collection (" << oldsize << " >= " << threshold << ")" << std::endl;
-                    htree.gc_full();
-                    // std::cerr << "Size reduced from " << oldsize << " to " << htree.total_bytes() << " bytes." << std::endl;
+                    htree.gc_begin();
+                    htree.gc_step(65536);
                     return true;
                 }
             }
@@ -62,7 +74,7 @@ namespace apg {
         }
 
         uint64_t counthandles() {
-            return htree.ihandles.size() + htree.handles.size();
+            return htree.counthandles();
         }
 
         kiventry<nicearray<I, 4>, I, lifemeta<I> >* ind2ptr_nonleaf(uint32_t depth, I index) {
@@ -47,6 +47,12 @@ namespace apg {
 
     };
 
+    // A non-leaf's gcflags above bit 9 describe the result memoised in res:
+    template<typename I>
+    I gc_reference(const lifemeta<I> &value, I gcflags) {
+        return (gcflags >> 9) ? value.res : 0;
+    }
+
     template<typename I>
     class lifetree_abstract {
 
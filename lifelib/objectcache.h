@@ -0,0 +1,241 @@
+#pragma once
+#include <stdint.h>
+#include <cstdlib>
+#include <array>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "apgcodes.h"
+
+namespace apg {
+
+    // A translated bitmap of up to 32x32 cells, as a 4x4 array of 8x8 tiles:
+    typedef std::array<uint64_t, 16> tileset;
+
+    struct tileset_hash {
+        size_t operator()(const tileset &tiles) const {
+            uint64_t h = 0;
+            for (int i = 0; i < 16; i++) {
+                h = (h ^ tiles[i]) * 0x9e3779b97f4a7c15ull;
+                h ^= (h >> 29);
+            }
+            return h;
+        }
+    };
+
+    /*
+    * The classifier's memo of objects it has already seen: small objects
+    * by the 64-bit bitstring of their 8x8 tile, medium objects by their
+    * tileset, and the decomposition of each apgcode (as IDs in
+    * apg::apgcodes) into its constituents. It may be shared by the
+    * classifiers of several threads running the same rule, so that each
+    * object is only separated once per process; each table is split into
+    * stripes with their own locks to keep contention low, as lookups
+    * vastly outnumber insertions.
+    *
+    * The cache can also be kept in a file, so that new processes start with
+    * every object their predecessors have seen. The file is append-only
+    * text, one entry per line, tagged with the rule:
+    *
+    *     B <rule> <bitstring in hex> <apgcode>
+    *     T <rule> <16 comma-separated tiles in hex> <apgcode>
+    *     D <rule> <apgcode> <constituent apgcodes...>
+    *
+    * and may be shared by several processes (and rules); an incomplete
+    * final line, as left by a process which was killed mid-write, is
+    * ignored.
+    */
+    class object_cache {
+
+        struct stripe {
+            std::mutex mutex;
+            std::unordered_map<uint64_t, uint32_t> bitcache;
+            std::unordered_map<tileset, uint32_t, tileset_hash> tilecache;
+            std::unordered_map<uint32_t, std::vector<uint32_t> > decompositions;
+        };
+
+        stripe stripes[64];
+
+        std::string rule;
+        bool persistent;
+        int fd;
+        std::mutex filemutex;
+
+        stripe &stripe_of(uint64_t key) {
+            key *= 0x9e3779b97f4a7c15ull;
+            return stripes[key >> 58];
+        }
+
+        void append(const std::string &entry) {
+            std::lock_guard<std::mutex> lock(filemutex);
+            if (fd < 0) { return; }
+            if (write(fd, entry.data(), entry.size()) != ((ssize_t) entry.size())) {
+                // Stop recording rather than risk a corrupt file:
+                close(fd); fd = -1;
+            }
+        }
+
+        int64_t load(const char* data, size_t size) {
+
+            int64_t loaded = 0;
+            size_t start = 0;
+
+            for (size_t i = 0; i < size; i++) {
+                if (data[i] != '\n') { continue; }
+                std::istringstream line(std::string(data + start, i - start));
+                start = i + 1;
+
+                std::string type, entryrule, key;
+                line >> type >> entryrule >> key;
+                if (entryrule != rule) { continue; }
+
+                if (type == "B") {
+                    std::string apgcode;
+                    line >> apgcode;
+                    uint64_t bb = std::strtoull(key.c_str(), 0, 16);
+                    if ((bb == 0) || apgcode.empty()) { continue; }
+                    stripe_of(bb).bitcache.emplace(bb, apgcodes.intern(apgcode));
+                    loaded += 1;
+                } else if (type == "T") {
+                    std::string apgcode;
+                    line >> apgcode;
+                    tileset tiles; tiles.fill(0);
+                    std::istringstream words(key);
+                    std::string word;
+                    int i = 0;
+                    while ((i < 16) && std::getline(words, word, ',')) {
+                        tiles[i++] = std::strtoull(word.c_str(), 0, 16);
+                    }
+                    if ((i != 16) || apgcode.empty()) { continue; }
+                    stripe_of(tileset_hash()(tiles)).tilecache.emplace(tiles, apgcodes.intern(apgcode));
+                    loaded += 1;
+                } else if (type == "D") {
+                    uint32_t repr = apgcodes.intern(key);
+                    std::vector<uint32_t> elements;
+                    std::string element;
+                    while (line >> element) { elements.push_back(apgcodes.intern(element)); }
+                    stripe_of(repr).decompositions.emplace(repr, elements);
+                    loaded += 1;
+                }
+            }
+
+            return loaded;
+        }
+
+    public:
+
+        object_cache() : persistent(false), fd(-1) { }
+
+        ~object_cache() {
+            if (fd >= 0) { close(fd); }
+        }
+
+        /*
+        * Loads the entries for a rule from a cache file (created if absent),
+        * and appends new entries to it if it is writable. Returns the number
+        * of entries loaded, or -1 if the file could not be opened.
+        */
+        int64_t open(const std::string &filename, const std::string &rule) {
+
+            this->rule = rule;
+            int rfd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+            bool writable = (rfd >= 0);
+            if (!writable) { rfd = ::open(filename.c_str(), O_RDONLY); }
+            if (rfd < 0) { return -1; }
+
+            int64_t loaded = 0;
+            struct stat st;
+            if ((fstat(rfd, &st) == 0) && (st.st_size > 0)) {
+                void* mem = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, rfd, 0);
+                if (mem != MAP_FAILED) {
+                    loaded = load((const char*) mem, st.st_size);
+                    munmap(mem, st.st_size);
+                }
+            }
+
+            if (writable) { fd = rfd; persistent = true; } else { close(rfd); }
+            return loaded;
+        }
+
+        bool find_bits(uint64_t bb, uint32_t &repr) {
+            stripe &s = stripe_of(bb);
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto it = s.bitcache.find(bb);
+            if (it == s.bitcache.end()) { return false; }
+            repr = it->second;
+            return true;
+        }
+
+        void insert_bits(uint64_t bb, uint32_t repr) {
+            bool inserted;
+            {
+                stripe &s = stripe_of(bb);
+                std::lock_guard<std::mutex> lock(s.mutex);
+                inserted = s.bitcache.emplace(bb, repr).second;
+            }
+            if (inserted && persistent) {
+                std::ostringstream entry;
+                entry << "B " << rule << " " << std::hex << bb << " " << apgcodes.apgcode(repr) << "\n";
+                append(entry.str());
+            }
+        }
+
+        bool find_tiles(const tileset &tiles, uint32_t &repr) {
+            stripe &s = stripe_of(tileset_hash()(tiles));
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto it = s.tilecache.find(tiles);
+            if (it == s.tilecache.end()) { return false; }
+            repr = it->second;
+            return true;
+        }
+
+        void insert_tiles(const tileset &tiles, uint32_t repr) {
+            bool inserted;
+            {
+                stripe &s = stripe_of(tileset_hash()(tiles));
+                std::lock_guard<std::mutex> lock(s.mutex);
+                inserted = s.tilecache.emplace(tiles, repr).second;
+            }
+            if (inserted && persistent) {
+                std::ostringstream entry;
+                entry << "T " << rule << " " << std::hex;
+                for (int i = 0; i < 16; i++) { entry << (i ? "," : "") << tiles[i]; }
+                entry << " " << apgcodes.apgcode(repr) << "\n";
+                append(entry.str());
+            }
+        }
+
+        bool find_decomposition(uint32_t repr, std::vector<uint32_t> &elements) {
+            stripe &s = stripe_of(repr);
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto it = s.decompositions.find(repr);
+            if (it == s.decompositions.end()) { return false; }
+            elements = it->second;
+            return true;
+        }
+
+        void insert_decomposition(uint32_t repr, const std::vector<uint32_t> &elements) {
+            bool inserted;
+            {
+                stripe &s = stripe_of(repr);
+                std::lock_guard<std::mutex> lock(s.mutex);
+                inserted = s.decompositions.emplace(repr, elements).second;
+            }
+            if (inserted && persistent) {
+                std::string entry = "D " + rule + " " + apgcodes.apgcode(repr);
+                for (uint64_t i = 0; i < elements.size(); i++) {
+                    entry += " " + apgcodes.apgcode(elements[i]);
+                }
+                append(entry + "\n");
+            }
+        }
+
+    };
+
+}
@@ -0,0 +1,64 @@
+/*
+* Checks dense_bitworld against bitworld on random clusters:
+*
+* g++ -O3 -march=native --std=c++11 test_densebitworld.cpp -o test_densebitworld
+*/
+
+#include "densebitworld.h"
+#include <random>
+
+int main() {
+
+    std::mt19937 rng(1);
+    int failures = 0;
+
+    for (int t = 0; t < 3000; t++) {
+
+        apg::bitworld live;
+        apg::bitworld env;
+        int n = rng() % 300;
+        int ox = ((int) (rng() % 200)) - 100;
+        int oy = ((int) (rng() % 200)) - 100;
+        int size = 1 + rng() % 150;
+        for (int i = 0; i < n; i++) {
+            int x = ox + rng() % size;
+            int y = oy + rng() % size;
+            env.setcell(x, y, 1);
+            if (rng() % 3) { live.setcell(x, y, 1); }
+        }
+        if (live.population() == 0) { continue; }
+
+        apg::dense_bitworld denv(env);
+        apg::dense_bitworld dlive = denv.blank();
+        dlive.load(live);
+
+        // Round trip:
+        apg::bitworld diff = dlive.tobitworld();
+        diff ^= live;
+        if (diff.population() != 0) { failures += 1; }
+
+        // Every cluster at once, against repeated growth in the same order:
+        std::string growths[5] = {"9", "95", "99", "5", "999999"};
+        std::string growth = growths[t % 5];
+        for (int whole = 0; whole < 2; whole++) {
+            std::vector<apg::bitworld> clusters = apg::find_clusters(live, env, growth, whole);
+            apg::bitworld lrem = live;
+            uint64_t count = 0;
+            while (lrem.population() != 0) {
+                apg::bitworld c = apg::grow_cluster(lrem.get1cell(), env, growth);
+                if (!whole) { c &= lrem; }
+                lrem -= c;
+                if (count < clusters.size()) {
+                    apg::bitworld d = clusters[count];
+                    d ^= c;
+                    if (d.population() != 0) { failures += 1; }
+                }
+                count += 1;
+            }
+            if (count != clusters.size()) { failures += 1; }
+        }
+    }
+
+    std::cout << (failures ? "FAILED" : "ok") << std::endl;
+    return (failures != 0);
+}
@@ -0,0 +1,63 @@
+/*
+* Repeats random operations on patterns in two lifetrees, one of which
+* collects garbage incrementally under a tiny threshold, and checks that
+* the results agree (needs the b3s23 kernels from rule2asm.py):
+*
+* g++ -O3 -march=native --std=c++11 test_gc.cpp -o test_gc
+*/
+
+#include "pattern2.h"
+#include <random>
+
+int main() {
+
+    apg::lifetree<uint32_t, 1> lt(0);
+    apg::lifetree<uint32_t, 1> reference(0);
+    lt.gc_threshold = 1 << 20;
+
+    std::mt19937 rng(1);
+    std::vector<apg::pattern> pats;
+    std::vector<apg::pattern> refs;
+
+    for (int i = 0; i < 16; i++) {
+        apg::bitworld bw;
+        for (int j = 0; j < 300; j++) { bw.setcell(rng() % 40, rng() % 40, 1); }
+        std::vector<apg::bitworld> planes(1, bw);
+        pats.emplace_back(&lt, planes, "b3s23");
+        refs.emplace_back(&reference, planes, "b3s23");
+    }
+
+    int failures = 0;
+    int cycles = 0;
+
+    for (int t = 0; t < 1000; t++) {
+
+        int i = rng() % 16;
+        int j = rng() % 16;
+        uint64_t gens = 1 + rng() % 200;
+        int64_t x = ((int) (rng() % 64)) - 32;
+        int64_t y = ((int) (rng() % 64)) - 32;
+
+        switch (rng() % 4) {
+            case 0: pats[i] = pats[j].advance(gens); refs[i] = refs[j].advance(gens); break;
+            case 1: pats[i] += pats[j].shift(x, y); refs[i] += refs[j].shift(x, y); break;
+            case 2: pats[i] -= pats[j].shift(x, y); refs[i] -= refs[j].shift(x, y); break;
+            case 3: pats[i] ^= pats[j]("rot90", x, y); refs[i] ^= refs[j]("rot90", x, y); break;
+        }
+
+        pats[i] = pats[i].subrect(-150, -150, 300, 300);
+        refs[i] = refs[i].subrect(-150, -150, 300, 300);
+        if (lt.htree.gcphase != lt.htree.GC_IDLE) { cycles += 1; }
+
+        if ((pats[i].digest() != refs[i].digest()) || (pats[i].popcount(1000000007) != refs[i].popcount(1000000007))) {
+            failures += 1;
+        }
+        if (refs[i].popcount(1000000007) == 0) { pats[i] = pats[j]; refs[i] = refs[j]; }
+    }
+
+    // The collector should actually have run:
+    if (cycles == 0) { failures += 1; }
+
+    std::cout << (failures ? "FAILED" : "ok") << std::endl;
+    return (failures != 0);
+}
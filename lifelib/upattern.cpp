@@ -1,29 +1,59 @@
 #include "upattern.h"
 #include "classifier.h"
 #include "incubator.h"
+#include <unordered_map>
 
-int main() {
+/*
+* A std::unordered_map tile index, as the upattern used to have, for
+* comparison with utileindex:
+*/
+template<typename T>
+class umapindex {
 
-    std::cout << "UTile<2, 1> size: " << sizeof(apg::UTile<2, 1>) << std::endl;
+    std::unordered_map<uint64_t, T*> tiles;
+
+    public:
+
+    T* find(uint64_t p) {
+        auto it = tiles.find(p);
+        return (it == tiles.end()) ? 0 : it->second;
+    }
+
+    void insert(uint64_t p, T* sqt) { tiles.emplace(p, sqt); }
+
+    void erase(uint64_t p) { tiles.erase(p); }
+};
+
+template<typename U>
+void lidka(std::string indexname) {
 
     clock_t start = clock();
 
-    // Do this twenty times so that we can accurately measure the time.
+    // Do this fifty times so that we can accurately measure the time.
     for (int i = 0; i < 50; i++) {
-        // apg::upattern<apg::UTile<2, 1>, 16> universe;
-        apg::upattern<apg::VTile28, 28> universe;
+        U universe;
         universe.tilesProcessed = 0;
         universe.insertPattern("6.A$6.3A2$3.2A3.A$3.A4.A$3A5.A!");
 
         universe.advance(0, 0, 30000);
 
-        std::cout << "Population count: " << universe.totalPopulation() << std::endl;
-        std::cout << "Tiles processed: " << universe.tilesProcessed << std::endl;
+        if (i == 0) {
+            std::cout << "Population count: " << universe.totalPopulation() << std::endl;
+            std::cout << "Tiles processed: " << universe.tilesProcessed << std::endl;
+        }
     }
 
     clock_t end = clock();
 
-    std::cout << "Lidka + 30k in " << ((double) (end-start) / CLOCKS_PER_SEC * 20.0) << " ms." << std::endl;
+    std::cout << "Lidka + 30k with " << indexname << " in " << ((double) (end-start) / CLOCKS_PER_SEC * 20.0) << " ms." << std::endl;
+}
+
+int main() {
+
+    std::cout << "UTile<2, 1> size: " << sizeof(apg::UTile<2, 1>) << std::endl;
+
+    lidka<apg::upattern<apg::VTile28, 28> >("utileindex");
+    lidka<apg::upattern<apg::VTile28, 28, umapindex<apg::VTile28> > >("std::unordered_map");
 
     apg::upattern<apg::VTile28, 28> universe;
     // apg::upattern<apg::UTile<2, 1>, 16> universe;
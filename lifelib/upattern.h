@@ -1,7 +1,7 @@
 #pragma once
 
 #include "avxlife/uli.h"
-#include <unordered_map>
+#include <stdlib.h>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -16,9 +16,116 @@ namespace apg {
                                     0xfffffffeffffffffull,
                                     0xffffffff00000000ull};
 
+    // Tiles are allocated in slabs of (1 << utilebits):
+    const static uint32_t utilebits = 8;
 
-    // Tile typename and width:
-    template<typename T, int W>
+    template<typename T>
+    class utileindex {
+        /*
+        * Flat hashtable from packed tile coordinates to tile pointers,
+        * using linear probing. Each key is stored beside its pointer, so
+        * a probe sequence stays within one or two cache lines and never
+        * dereferences a tile. Deletion shifts later entries backwards
+        * rather than leaving tombstones.
+        */
+
+        struct entry {
+            uint64_t key;
+            T* ptr;
+        };
+
+        entry* table;
+        uint64_t hashbits;
+        uint64_t count;
+
+        uint64_t key2slot(uint64_t p) {
+            return (p * 0x9e3779b97f4a7c15ull) >> (64 - hashbits);
+        }
+
+        void resize_hash(uint64_t newbits) {
+
+            // Create a new hashtable:
+            entry* oldtable = table;
+            uint64_t oldsize = (oldtable == 0) ? 0 : (1ull << hashbits);
+            hashbits = newbits;
+            table = (entry*) calloc(1ull << hashbits, sizeof(entry));
+            if (table == 0) {
+                std::cerr << "Memory error!!!" << std::endl;
+                exit(1);
+            }
+
+            uint64_t mask = (1ull << hashbits) - 1;
+            for (uint64_t i = 0; i < oldsize; i++) {
+                if (oldtable[i].ptr) {
+                    uint64_t h = key2slot(oldtable[i].key);
+                    while (table[h].ptr) { h = (h + 1) & mask; }
+                    table[h] = oldtable[i];
+                }
+            }
+            free(oldtable);
+        }
+
+        public:
+
+        T* find(uint64_t p) {
+            uint64_t mask = (1ull << hashbits) - 1;
+            uint64_t h = key2slot(p);
+            while (table[h].ptr) {
+                if (table[h].key == p) { return table[h].ptr; }
+                h = (h + 1) & mask;
+            }
+            return 0;
+        }
+
+        void insert(uint64_t p, T* sqt) {
+            // The key p must not already be present:
+            uint64_t mask = (1ull << hashbits) - 1;
+            uint64_t h = key2slot(p);
+            while (table[h].ptr) { h = (h + 1) & mask; }
+            table[h].key = p;
+            table[h].ptr = sqt;
+            count += 1;
+            if (count * 2 > mask) { resize_hash(hashbits + 1); }
+        }
+
+        void erase(uint64_t p) {
+            // The key p must be present:
+            uint64_t mask = (1ull << hashbits) - 1;
+            uint64_t i = key2slot(p);
+            while (table[i].key != p) { i = (i + 1) & mask; }
+
+            // Close the gap by moving back any entry whose probe
+            // sequence passes through it:
+            uint64_t j = i;
+            for (;;) {
+                j = (j + 1) & mask;
+                if (table[j].ptr == 0) { break; }
+                uint64_t h = key2slot(table[j].key);
+                if (((j - h) & mask) >= ((j - i) & mask)) {
+                    table[i] = table[j];
+                    i = j;
+                }
+            }
+            table[i].key = 0;
+            table[i].ptr = 0;
+            count -= 1;
+        }
+
+        utileindex() {
+            table = 0;
+            count = 0;
+            resize_hash(6);
+        }
+
+        utileindex(const utileindex&) = delete;
+        utileindex& operator=(const utileindex&) = delete;
+
+        ~utileindex() { free(table); }
+    };
+
+
+    // Tile typename, width and coordinate index:
+    template<typename T, int W, typename I = utileindex<T> >
     class upattern {
         /*
         * A container capable of running patterns in either (unhashed) ulife
@@ -31,19 +138,105 @@ namespace apg {
         * 2W. In the former case, new tiles are allocated as the pattern
         * expands; in the latter case, the entire universe is preallocated in
         * memory at creation time.
+        *
+        * Tiles live in slabs which are only freed when the upattern is
+        * destroyed, and are found through an index I keyed on their
+        * coordinates (a utileindex unless otherwise specified). Calling
+        * reset() empties the universe in time proportional to the number
+        * of tiles in use, so a single upattern can be reused for many
+        * soups without any allocation.
+        *
+        * The total population and hash are kept as running sums: a tile
+        * whose contents change is put on the stale list, and only the
+        * tiles on that list are recounted when the totals are requested.
         */
 
         private:
         uint64_t torus_width;
         uint64_t torus_height;
 
+        std::vector<T*> slablist;
+        I index;
+
+        T* newtile(uint64_t p) {
+            if (tilecount == (slablist.size() << utilebits)) {
+                T* nextslab;
+                if (posix_memalign((void**) &nextslab, 64, sizeof(T) << utilebits)) {
+                    std::cerr << "Memory error!!!" << std::endl;
+                    exit(1);
+                }
+                std::memset((void*) nextslab, 0, sizeof(T) << utilebits);
+                slablist.push_back(nextslab);
+            }
+            T* sqt = tileptr(tilecount);
+            sqt->coords = p;
+            tilecount += 1;
+            stale.push_back(sqt);
+            return sqt;
+        }
+
         public:
-        std::unordered_map<uint64_t, T> tiles;
+        uint64_t tilecount;
         std::vector<T*> modified;
         std::vector<T*> temp_modified;
 
+        // Tiles not yet counted in the totals since they last changed,
+        // which are exactly those whose populationCurrent flag is false:
+        std::vector<T*> stale;
+        int64_t populationTotal;
+        uint64_t hashTotal;
+        int hashRadius; // of the tiles included in hashTotal, or -1
+
         uint64_t tilesProcessed;
 
+        // Convert index (in order of creation) to pointer:
+        T* tileptr(uint64_t i) {
+            return (slablist[i >> utilebits] + (i & ((1 << utilebits) - 1)));
+        }
+
+        T* getTile(uint64_t p) {
+            // Returns the tile with packed coordinates p, creating it if necessary:
+            T* sqt = index.find(p);
+            if (sqt == 0) {
+                sqt = newtile(p);
+                index.insert(p, sqt);
+            }
+            return sqt;
+        }
+
+        void reset() {
+            /*
+            * Empty the universe but retain its memory. A torus keeps all
+            * of its tiles, still wired together as the constructor left
+            * them, and only their contents are cleared:
+            */
+            modified.clear();
+            temp_modified.clear();
+            stale.clear();
+            if (torus_width > 0) {
+                for (uint64_t i = 0; i < tilecount; i++) {
+                    T* sqt = tileptr(i);
+                    T* neighbours[6];
+                    std::memcpy(neighbours, sqt->neighbours, sizeof(neighbours));
+                    uint64_t coords = sqt->coords;
+                    std::memset((void*) sqt, 0, sizeof(T));
+                    std::memcpy(sqt->neighbours, neighbours, sizeof(neighbours));
+                    sqt->coords = coords;
+                    stale.push_back(sqt);
+                }
+            } else {
+                while (tilecount > 0) {
+                    tilecount -= 1;
+                    T* sqt = tileptr(tilecount);
+                    index.erase(sqt->coords);
+                    std::memset((void*) sqt, 0, sizeof(T));
+                }
+            }
+            populationTotal = 0;
+            hashTotal = 0;
+            tilesProcessed = 0;
+        }
+
         T* coords2ptr(int64_t x, int64_t w) {
             // Returns a pointer to tile x + omega*w.
             int64_t ix = x; int64_t iw = w;
@@ -55,14 +248,16 @@ namespace apg {
             }
             uint64_t p = ((uint64_t) (ix + 0x80000000ull));
             p += (((uint64_t) (iw + 0x80000000ull)) << 32);
-            T* sqt = &(tiles[p]);
-            sqt->coords = p;
-            return sqt;
+            return getTile(p);
         }
 
         upattern() {
             // Construct an unbounded plane universe:
             tilesProcessed = 0;
+            tilecount = 0;
+            populationTotal = 0;
+            hashTotal = 0;
+            hashRadius = -1;
             torus_width = 0;
             torus_height = 0;
         }
@@ -70,6 +265,10 @@ namespace apg {
         upattern(int width, int height) {
             // Construct a rectangular toroidal universe:
             tilesProcessed = 0;
+            tilecount = 0;
+            populationTotal = 0;
+            hashTotal = 0;
+            hashRadius = -1;
             torus_width = width / W;
             torus_height = height / W;
 
@@ -89,18 +288,29 @@ namespace apg {
             } 
         }
 
+        // Tiles point to one another, so a upattern cannot be copied:
+        upattern(const upattern&) = delete;
+        upattern& operator=(const upattern&) = delete;
+
+        ~upattern() {
+
+            // Destroy all the memory we malloc'd:
+            while (!slablist.empty()) {
+                free(slablist.back());
+                slablist.pop_back();
+            }
+        }
+
         T* getNeighbour(T* sqt, int i) {
             if (!(sqt->neighbours[i])) {
-                uint64_t x = sqt->coords + udirections[i];
-                sqt->neighbours[i] = &tiles[x];
-                sqt->neighbours[i]->coords = x;
+                sqt->neighbours[i] = getTile(sqt->coords + udirections[i]);
             }
             return sqt->neighbours[i];
         }
 
         void decache() {
-            for (auto it = tiles.begin(); it != tiles.end(); ++it) {
-                T* sqt = &(it->second);
+            for (uint64_t i = 0; i < tilecount; i++) {
+                T* sqt = tileptr(i);
                 if (sqt->updateflags == 0) {
                     modified.push_back(sqt);
                     sqt->updateflags |= 64;
@@ -179,21 +389,66 @@ namespace apg {
             }
         }
 
-        int totalPopulation() {
+        bool withinRadius(T* sqt, int radius) {
+            int64_t tx = (sqt->coords & 0xffffffffu) - 0x80000000u;
+            int64_t tw = (sqt->coords >> 32) - 0x80000000u;
+            return (tx * tx + tw * tw - tx * tw < radius * radius);
+        }
 
-            int population = 0;
+        uint64_t hashContribution(T* sqt) {
+            return sqt->hash * (sqt->coords ^ 3141592653589793ull);
+        }
 
-            for (auto it = tiles.begin(); it != tiles.end(); ++it) {
-                T* sqt = &(it->second);
-                population += sqt->countPopulation();
+        void aggregate() {
+            // Replace the stale tiles' old contributions to the totals:
+            while (!stale.empty()) {
+                T* sqt = stale.back();
+                stale.pop_back();
+                bool inside = (hashRadius >= 0) && withinRadius(sqt, hashRadius);
+                populationTotal -= sqt->population;
+                if (inside) { hashTotal -= hashContribution(sqt); }
+                populationTotal += sqt->countPopulation();
+                sqt->hashTile();
+                if (inside) { hashTotal += hashContribution(sqt); }
             }
+        }
 
-            return population;
+        int totalPopulation() {
+            aggregate();
+            return populationTotal;
         }
 
         bool nonempty() { return (totalPopulation() != 0); }
 
-        void emplace_uint64(int z, int64_t x, int64_t y, uint64_t v) {
+        void touch(T* sqt) {
+            // Record that a tile has been written to by an insertion:
+            if ((sqt->updateflags & 128) == 0) {
+                if (sqt->updateflags == 0) { modified.push_back(sqt); }
+                sqt->updateflags |= 192;
+            }
+            if (sqt->populationCurrent) { stale.push_back(sqt); }
+            sqt->populationCurrent = false;
+            sqt->hashCurrent = false;
+        }
+
+        void finishInsertion() {
+            /*
+            * Every tile touched since the last call is in the modified
+            * list; schedule each of those, and its six neighbours, for
+            * boundary updates exactly once, rather than once per block
+            * written.
+            */
+            uint64_t n = modified.size();
+            for (uint64_t i = 0; i < n; i++) {
+                T* sqt = modified[i];
+                if (sqt->updateflags & 128) {
+                    sqt->updateflags &= 127;
+                    for (int j = 0; j < 6; j++) { updateNeighbour(sqt, j); }
+                }
+            }
+        }
+
+        void place_uint64(int z, int64_t x, int64_t y, uint64_t v) {
             int64_t ay = y;
             uint8_t dy = ((ay % W) + W) % W;
             ay -= dy;
@@ -207,26 +462,44 @@ namespace apg {
             sqt->eu64(this, z, dx, dy, v);
         }
 
+        void emplace_uint64(int z, int64_t x, int64_t y, uint64_t v) {
+            place_uint64(z, x, y, v);
+            finishInsertion();
+        }
+
+        void insertBlocks(int z, int n, const int32_t* x, const int32_t* y, const uint64_t* v) {
+            /*
+            * Insert n 8-by-8 blocks, with the coordinates and layout of
+            * bitworld entries, without an intermediate bitworld. This
+            * allocates nothing beyond any tiles it creates.
+            */
+            for (int i = 0; i < n; i++) {
+                if (v[i] != 0) { place_uint64(z, 8 * x[i], 8 * y[i], v[i]); }
+            }
+            finishInsertion();
+        }
+
         void insertPattern(std::vector<bitworld> &planes) {
             for (uint64_t i = 0; i < planes.size(); i++) {
                 // if (i == N) { break; }
                 for (auto it = planes[i].world.begin(); it != planes[i].world.end(); ++it) {
                     if (it->second != 0) {
-                        emplace_uint64(i, 8 * it->first.first, 8 * it->first.second, it->second);
+                        place_uint64(i, 8 * it->first.first, 8 * it->first.second, it->second);
                     }
                 }
             }
+            finishInsertion();
         }
 
         void clearHistory() {
-            for (auto it = tiles.begin(); it != tiles.end(); ++it) {
-                it->second.clearHistory();
+            for (uint64_t i = 0; i < tilecount; i++) {
+                tileptr(i)->clearHistory();
             }
         }
 
         void extractPattern(std::vector<bitworld> &planes) {
-            for (auto it = tiles.begin(); it != tiles.end(); ++it) {
-                T* sqt = &(it->second);
+            for (uint64_t j = 0; j < tilecount; j++) {
+                T* sqt = tileptr(j);
                 int64_t tx = (sqt->coords & 0xffffffffu) - 0x80000000u;
                 int64_t tw = (sqt->coords >> 32) - 0x80000000u;
                 int64_t x = tx * W - tw * (W/2);
@@ -246,19 +519,19 @@ namespace apg {
 
         uint64_t totalHash(int radius) {
 
-            uint64_t globalhash = 0;
+            aggregate();
 
-            for (auto it = tiles.begin(); it != tiles.end(); ++it)
-            {
-                T* sqt = &(it->second);
-                int64_t tx = (sqt->coords & 0xffffffffu) - 0x80000000u;
-                int64_t tw = (sqt->coords >> 32) - 0x80000000u;
-                if (tx * tx + tw * tw - tx * tw < radius * radius) {
-                    globalhash += sqt->hashTile() * (sqt->coords ^ 3141592653589793ull);
+            if (radius != hashRadius) {
+                // Every tile is now current, so this only sums their hashes:
+                hashRadius = radius;
+                hashTotal = 0;
+                for (uint64_t i = 0; i < tilecount; i++) {
+                    T* sqt = tileptr(i);
+                    if (withinRadius(sqt, radius)) { hashTotal += hashContribution(sqt); }
                 }
             }
 
-            return globalhash;
+            return hashTotal;
         }
     };
 
@@ -318,7 +591,8 @@ namespace apg {
             }
         }
 
-        void updateTile(upattern<VTile28, 28>* owner, int rule, int family, int mantissa) {
+        template<typename U>
+        void updateTile(U* owner, int rule, int family, int mantissa) {
 
             (void) mantissa;
             uint32_t diffs[3] = {0};
@@ -331,6 +605,7 @@ namespace apg {
             }
 
             if ((r != 1) && (diffs[0] & 0x3ffffffcu)) {
+                if (populationCurrent) { owner->stale.push_back(this); }
                 populationCurrent = false;
                 hashCurrent = false;
                 if (updateflags == 0) { owner->modified.push_back(this); }
@@ -394,15 +669,14 @@ namespace apg {
             return bw;
         }
 
-        void eu64(upattern<VTile28, 28>* owner, int z, uint8_t dx, uint8_t dy, uint64_t v) {
+        template<typename U>
+        void eu64(U* owner, int z, uint8_t dx, uint8_t dy, uint64_t v) {
 
             // std::cout << ((int) dx) << " " << ((int) dy) << " " << v << std::endl;
 
             if ((v == 0) || (z >= 2)) { return; }
 
-            for (int i = 0; i < 6; i++) { owner->updateNeighbour(this, i); }
-            if (updateflags == 0) { owner->modified.push_back(this); }
-            updateflags |= 64;
+            owner->touch(this);
 
             uint32_t* q = (z ? hist : d);
 
@@ -517,7 +791,8 @@ namespace apg {
             return partialhash;
         }
 
-        void updateTile(upattern<UTile<N, M>, 16>* owner, int rule, int family, uint64_t mantissa) {
+        template<typename U>
+        void updateTile(U* owner, int rule, int family, uint64_t mantissa) {
             uint64_t outleafx[4*N] = {0ull};
             uint64_t* inleafxs[4] = {a, b, c, d};
             int r = universal_leaf_iterator<N>(rule, family, mantissa, inleafxs, outleafx);
@@ -530,6 +805,7 @@ namespace apg {
                     diff[0] |= (outleafx[3 + 4*i] ^ d[0 + 4*i]);
                 }
                 if (diff[0] | diff[1] | diff[2] | diff[3]) {
+                    if (populationCurrent) { owner->stale.push_back(this); }
                     populationCurrent = false;
                     hashCurrent = false;
                     if (updateflags == 0) { owner->modified.push_back(this); }
@@ -589,11 +865,10 @@ namespace apg {
             return bw;
         }
 
-        void eu64(upattern<UTile<N, M>, 16>* owner, int z, uint8_t dx, uint8_t dy, uint64_t v) {
+        template<typename U>
+        void eu64(U* owner, int z, uint8_t dx, uint8_t dy, uint64_t v) {
 
-            for (int i = 0; i < 6; i++) { owner->updateNeighbour(this, i); }
-            if (updateflags == 0) { owner->modified.push_back(this); }
-            updateflags |= 64;
+            owner->touch(this);
 
             uint8_t dz = (dx / 8) + (dy / 8) * 2;
 
@@ -29,6 +29,25 @@
 #include "includes/searcher.h"
 #include "includes/searching.h"
 
+/*
+ * Rebuild apgluxe for a rule which has not been compiled in, keeping the
+ * existing rules (unless --rules overrides them), and run it again:
+ */
+int recompile(int argc, char *argv[]) {
+
+    std::vector<char*> args(argv, argv + argc);
+    std::string rulestrings = RULESTRINGS;
+
+    if (std::find_if(args.begin(), args.end(), [](char* a) { return strcmp(a, "--rules") == 0; }) == args.end()) {
+        args.push_back((char*) "--rules");
+        args.push_back(&rulestrings[0]);
+    }
+    args.push_back(0);
+
+    execvp("./recompile.sh", args.data());
+    return 1;
+}
+
 int main (int argc, char *argv[]) {
 
     // Default values:
@@ -36,6 +55,9 @@ int main (int argc, char *argv[]) {
     std::string seed = reseed("original seed");
     int parallelisation = 0;
     bool testing = false;
+    std::string rulestring = RULESTRING;
+    std::string symmetry = SYMMETRY;
+    std::string cachefile = "";
     int nullargs = 1;
     bool quitByUser = false;
     struct termios ttystate;
@@ -55,26 +77,40 @@ int main (int argc, char *argv[]) {
             parallelisation = atoi(argv[i+1]);
         } else if (strcmp(argv[i], "--rule") == 0) {
             std::cout << "\033[1;33mapgluxe " << APG_VERSION << "\033[0m: ";
-            std::string desired_rulestring = argv[i+1];
-            if (strcmp(RULESTRING, argv[i+1]) == 0) {
-                std::cout << "Rule \033[1;34m" << RULESTRING << "\033[0m is correctly configured." << std::endl;
+            rulestring = argv[i+1];
+            if (ruleCompiled(rulestring)) {
+                std::cout << "Rule \033[1;34m" << rulestring << "\033[0m is correctly configured." << std::endl;
+                nullargs += 2;
+            } else if (apg::rule2int(rulestring) >= 0) {
+                std::cout << "Rule \033[1;34m" << rulestring << "\033[0m will use JIT-compiled kernels." << std::endl;
                 nullargs += 2;
             } else {
-                std::cout << "Rule \033[1;34m" << RULESTRING << "\033[0m does not match desired rule \033[1;34m";
-                std::cout << desired_rulestring << "\033[0m." << std::endl;
-                execvp("./recompile.sh", argv);
-                return 1;
+                std::cout << "Rule \033[1;34m" << rulestring << "\033[0m is not among the compiled rules \033[1;34m";
+                std::cout << RULESTRINGS << "\033[0m." << std::endl;
+                return recompile(argc, argv);
+            }
+        } else if (strcmp(argv[i], "--rules") == 0) {
+            std::istringstream rules(argv[i+1]);
+            std::string rule;
+            while (std::getline(rules, rule, ',')) {
+                if (!ruleCompiled(rule)) {
+                    std::cout << "\033[1;33mapgluxe " << APG_VERSION << "\033[0m: ";
+                    std::cout << "Rule \033[1;34m" << rule << "\033[0m is not among the compiled rules \033[1;34m";
+                    std::cout << RULESTRINGS << "\033[0m." << std::endl;
+                    return recompile(argc, argv);
+                }
             }
+            nullargs += 2;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            cachefile = argv[i+1];
         } else if (strcmp(argv[i], "--symmetry") == 0) {
             std::cout << "\033[1;33mapgluxe " << APG_VERSION << "\033[0m: ";
-            std::string desired_symmetry = argv[i+1];
-            if (strcmp(SYMMETRY, argv[i+1]) == 0) {
-                std::cout << "Symmetry \033[1;34m" << SYMMETRY << "\033[0m is correctly configured." << std::endl;
+            symmetry = argv[i+1];
+            if (apg::validsymmetry(symmetry)) {
+                std::cout << "Symmetry \033[1;34m" << symmetry << "\033[0m is correctly configured." << std::endl;
                 nullargs += 2;
             } else {
-                std::cout << "Symmetry \033[1;34m" << SYMMETRY << "\033[0m does not match desired symmetry \033[1;34m";
-                std::cout << desired_symmetry << "\033[0m." << std::endl;
-                execvp("./recompile.sh", argv);
+                std::cout << "Invalid symmetry: \033[1;31m" << symmetry << "\033[0m is not one of the supported symmetries." << std::endl;
                 return 1;
             }
         }
@@ -89,8 +125,8 @@ int main (int argc, char *argv[]) {
     tcsetattr(STDIN_FILENO, TCSANOW, &ttystate);
 
     std::cout << "\nGreetings, this is \033[1;33mapgluxe " << APG_VERSION;
-    std::cout << "\033[0m, configured for \033[1;34m" << RULESTRING << "/";
-    std::cout << SYMMETRY << "\033[0m.\n" << std::endl;
+    std::cout << "\033[0m, configured for \033[1;34m" << rulestring << "/";
+    std::cout << symmetry << "\033[0m.\n" << std::endl;
 
     std::cout << "\033[32;1mLifelib version:\033[0m " << LIFELIB_VERSION << std::endl;
     std::cout << "\033[32;1mCompiler version:\033[0m " << __VERSION__ << std::endl;
@@ -98,22 +134,12 @@ int main (int argc, char *argv[]) {
 
     std::cout << std::endl;
 
-    while (!quitByUser) {
-        // Run the search:
-        std::cout << "Using seed " << seed << std::endl;
-        if (parallelisation > 0) {
-            #ifdef USE_OPEN_MP
-            quitByUser = parallelSearch(soups_per_haul, parallelisation, seed);
-            #else
-            quitByUser = runSearch(soups_per_haul, seed);
-            #endif
-        } else {
-            quitByUser = runSearch(soups_per_haul, seed);
-        }
-        seed = reseed(seed);
-
-        if (testing) { break; }
-    }
+    SearchLauncher launcher(SearchParams(rulestring, symmetry, cachefile));
+    launcher.soups_per_haul = soups_per_haul;
+    launcher.parallelisation = parallelisation;
+    launcher.seed = seed;
+    launcher.testing = testing;
+    quitByUser = withRule(rulestring, launcher);
 
     // turn on blocking reads
     tcgetattr(STDIN_FILENO, &ttystate);
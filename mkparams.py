@@ -4,11 +4,32 @@ import sys
 import re
 
 
+def ruletypes(rulestring):
+
+    m = re.match('b1?2?3?4?5?6?7?8?s0?1?2?3?4?5?6?7?8?$', rulestring)
+
+    if (rulestring[0] == 'g'):
+        bitplanes = int(rulestring[1:rulestring.index('b')])
+        bitplanes = 2 if (bitplanes == 3) else len(bin(bitplanes - 3))
+    else:
+        bitplanes = 1
+
+    if m is None:
+        # Arbitrary rules should use the Universal Leaf Iterator:
+        upattern = "apg::upattern<apg::UTile<%d, %d>, 16>" % (bitplanes + 1, bitplanes)
+    else:
+        # Special speedup for life-like rules to ensure comparable performance to v3.x:
+        upattern = "apg::upattern<apg::VTile28, 28>"
+
+    return (bitplanes, upattern)
+
+
 def main():
 
     if (len(sys.argv) < 3):
         print("Usage:")
         print("python mkparams.py b3s23 C1")
+        print("python mkparams.py b3s23,b36s23,g4b2s345 C1")
         exit(1)
 
     rulestring = sys.argv[1]
@@ -28,38 +49,32 @@ def main():
 
     print("Valid symmetry: \033[1;32m"+symmetry+"\033[0m")
 
-    m = re.match('b1?2?3?4?5?6?7?8?s0?1?2?3?4?5?6?7?8?$', rulestring)
-
-    if (rulestring[0] == 'g'):
-        bitplanes = int(rulestring[1:rulestring.index('b')])
-        bitplanes = 2 if (bitplanes == 3) else len(bin(bitplanes - 3))
-    else:
-        bitplanes = 1
-
-    if m is None:
-        # Arbitrary rules should use the Universal Leaf Iterator:
-        upattern = "apg::upattern<apg::UTile<BITPLANES + 1, BITPLANES>, 16>"
-    else:
-        # Special speedup for life-like rules to ensure comparable performance to v3.x:
-        upattern = "apg::upattern<apg::VTile28, 28>"
+    # The first rule is the default; any others are also compiled in, so
+    # that './apgluxe --rule <rule>' can switch between them at startup:
+    rules = rulestring.split(',')
 
     with open('includes/params.h', 'w') as g:
 
         g.write('#define PYTHON_VERSION "%s"\n' % repr(sys.version.replace('\n', ' ')))
-        g.write('#define BITPLANES %d\n' % bitplanes)
         g.write('#define SYMMETRY "%s"\n' % symmetry)
-        g.write('#define RULESTRING "%s"\n' % rulestring)
-        g.write('#define RULESTRING_SLASHED "%s"\n' % rulestring.replace('b', 'B').replace('s', '/S'))
-        g.write("#define UPATTERN %s\n" % upattern)
-        g.write('#define CLASSIFIER apg::base_classifier<BITPLANES>\n')
-
-        if (symmetry == 'C1'):
-            g.write('#define C1_SYMMETRY 1\n')
-        if (rulestring == 'b3s23'):
-            g.write('#define STANDARD_LIFE 1\n')
-            g.write('#define INCUBATE 1\n')
-        if (re.match('b36?7?8?s0?235?6?7?8?$', rulestring)):
-            g.write('#define GLIDERS_EXIST 1\n')
+        g.write('#define RULESTRING "%s"\n' % rules[0])
+        g.write('#define RULESTRINGS "%s"\n\n' % ','.join(rules))
+
+        g.write('bool ruleCompiled(std::string rulestring) {\n')
+        for rule in rules:
+            g.write('    if (rulestring == "%s") { return true; }\n' % rule)
+        g.write('    return false;\n')
+        g.write('}\n\n')
+
+        g.write('// Call f.run<BITPLANES, UPATTERN>() for a compiled rule:\n')
+        g.write('template<typename F>\n')
+        g.write('bool withRule(std::string rulestring, F &f) {\n')
+        for rule in rules:
+            g.write('    if (rulestring == "%s") { return f.template run<%d, %s >(); }\n' % ((rule,) + ruletypes(rule)))
+        g.write('    // Any other life-like rule runs on kernels compiled at startup:\n')
+        g.write('    if (apg::rule2int(rulestring) >= 0) { return f.template run<1, %s >(); }\n' % ruletypes('b3s23')[1])
+        g.write('    return false;\n')
+        g.write('}\n')
 
 
 main()
@@ -12,6 +12,7 @@ rm -f "includes/params.h" | true
 
 rulearg=`echo "$@" | grep -o "\\-\\-rule [a-z0-9-]*" | sed "s/\\-\\-rule\\ //"`
 symmarg=`echo "$@" | grep -o "\\-\\-symmetry [a-zA-Z0-9_+]*" | sed "s/\\-\\-symmetry\\ //"`
+rulesarg=`echo "$@" | grep -o "\\-\\-rules [a-z0-9,-]*" | sed "s/\\-\\-rules\\ //"`
 
 # Ensure lifelib matches the version in the repository:
 # bash update-lifelib.sh
@@ -35,10 +36,13 @@ else
 launch=1
 fi
 
-echo "Configuring rule $rulearg; symmetry $symmarg"
+# Compile in any further rules given by --rules, after the default:
+rulelist=`echo "$rulearg,$rulesarg" | tr ',' '\n' | grep -v "^$" | awk '!seen[$0]++' | tr '\n' ' '`
 
-python lifelib/avxlife/rule2asm.py $rulearg
-python mkparams.py $rulearg $symmarg
+echo "Configuring rules $rulelist; symmetry $symmarg"
+
+python lifelib/avxlife/rule2asm.py $rulelist
+python mkparams.py `echo $rulelist | tr ' ' ','` $symmarg
 make
 
 if (($launch == 1))